@@ -0,0 +1,235 @@
+// Copyright (c) 2021 Vitaly Dikov
+// 
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at https://www.boost.org/LICENSE_1_0.txt)
+
+#include<iostream>
+#include<iomanip>
+#include<string>
+#include<vector>
+#include<set>
+#include<map>
+#include<unordered_map>
+#include<algorithm>
+#include<memory>
+#include<iterator>
+#include<limits>
+#include<random>
+#include<chrono>
+#include<atomic>
+#include<mutex>
+#include<shared_mutex>
+#include<functional>
+#include "Regex/regexpr.hpp"
+#include "Error/error.hpp"
+
+namespace RegexBenchmark
+{
+    struct GeneratedDFA {
+        std::string family;
+        size_t nSymbols;
+        std::vector<bool> accept;
+        std::vector<RE::NumberedTransition> trans;
+    };
+
+    // partition refinement used by Regexp::MinimizeDFA before the worklist algorithm:
+    // every block is split until the partition no longer changes
+    class FixedPointPartition {
+        std::vector<std::vector<RE::NumberedTransition>> out;   // transitions of each state sorted by symbol
+        size_t nSymbols;
+    private:
+        RE::Index FindTransition(const RE::Index state, const RE::Index symbol) const
+        {
+            auto it = std::lower_bound(out[state].begin(), out[state].end(), symbol,
+                [](const RE::NumberedTransition& t, RE::Index s) { return t.symbol < s; });
+            if (it == out[state].end() || it->symbol != symbol) {
+                return std::numeric_limits<RE::Index>::max();
+            }
+            return it->to;
+        }
+
+        std::pair<std::vector<RE::Index>, std::vector<RE::Index>> Split(
+            const std::vector<RE::Index>& set,
+            const std::vector<RE::Index>& indexes) const
+        {
+            constexpr RE::Index none = std::numeric_limits<RE::Index>::max();
+            std::vector<RE::Index> first;
+            std::vector<RE::Index> second;
+            for (RE::Index symbol = 0; symbol < nSymbols; ++symbol) {
+                const RE::Index target0 = FindTransition(set[0], symbol);
+                const RE::Index block0 = (target0 == none) ? none : indexes[target0];
+                for (const RE::Index q : set) {
+                    const RE::Index target = FindTransition(q, symbol);
+                    const RE::Index block = (target == none) ? none : indexes[target];
+                    if (block == block0) {
+                        first.push_back(q);
+                    }
+                    else {
+                        second.push_back(q);
+                    }
+                }
+                if (second.size() != 0) {
+                    return { first, second };
+                }
+                first.clear();
+            }
+            return { set, second };
+        }
+    public:
+        FixedPointPartition(const GeneratedDFA& dfa)
+            : out(dfa.accept.size()), nSymbols{ dfa.nSymbols }
+        {
+            for (const RE::NumberedTransition& t : dfa.trans) {
+                out[t.from].push_back(t);
+            }
+            for (auto& v : out) {
+                std::sort(v.begin(), v.end(),
+                    [](const RE::NumberedTransition& a, const RE::NumberedTransition& b) { return a.symbol < b.symbol; });
+            }
+        }
+
+        std::vector<RE::Index> Run(const std::vector<bool>& accept) const
+        {
+            std::vector<RE::Index> indexes(accept.size());
+            std::vector<std::vector<RE::Index>> sp;
+            std::vector<std::vector<RE::Index>> temp(2);
+            for (RE::Index q = 0; q < accept.size(); ++q) {
+                indexes[q] = accept[q] ? 0 : 1;
+                temp[indexes[q]].push_back(q);
+            }
+            if (temp[1].size() == 0) {
+                temp.pop_back();
+            }
+            RE::Index index = temp.size() - 1;
+            while (sp.size() != temp.size()) {
+                sp = temp;
+                temp.clear();
+                temp.resize(sp.size());
+                for (RE::Index i = 0; i < sp.size(); ++i) {
+                    if (sp[i].size() == 1) {
+                        temp[i] = sp[i];
+                        continue;
+                    }
+                    std::pair<std::vector<RE::Index>, std::vector<RE::Index>> pair = Split(sp[i], indexes);
+                    temp[i] = pair.first;
+                    if (pair.second.size() != 0) {
+                        ++index;
+                        for (const RE::Index q : pair.second) {
+                            indexes[q] = index;
+                        }
+                        temp.push_back(pair.second);
+                    }
+                }
+            }
+            return indexes;
+        }
+    };
+
+    // states 0 -> 1 -> ... -> n-1 on one symbol, the last one is accepting: no two states are equivalent,
+    // and the fixed-point refinement separates one state per round
+    GeneratedDFA GenerateChain(const size_t n)
+    {
+        GeneratedDFA dfa{ "chain", 1, std::vector<bool>(n, false), {} };
+        dfa.accept[n - 1] = true;
+        for (RE::Index q = 0; q + 1 < n; ++q) {
+            dfa.trans.push_back(RE::NumberedTransition{ q, 0, q + 1 });
+        }
+        return dfa;
+    }
+
+    // random DFA, each state has a transition on each symbol with probability 'density'
+    GeneratedDFA GenerateRandom(const size_t n, const size_t nSymbols, const double density, const unsigned int seed)
+    {
+        GeneratedDFA dfa{ "random", nSymbols, std::vector<bool>(n, false), {} };
+        std::mt19937 gen{ seed };
+        std::uniform_int_distribution<RE::Index> state{ 0, n - 1 };
+        std::bernoulli_distribution accept{ 0.1 };
+        std::bernoulli_distribution exists{ density };
+        for (RE::Index q = 0; q < n; ++q) {
+            dfa.accept[q] = accept(gen);
+            for (RE::Index s = 0; s < nSymbols; ++s) {
+                if (exists(gen)) {
+                    dfa.trans.push_back(RE::NumberedTransition{ q, s, state(gen) });
+                }
+            }
+        }
+        return dfa;
+    }
+
+    // the DFA of (a|b)*a(a|b){k}, 2^(k+1) states that are all distinct
+    GeneratedDFA GenerateSuffix(const size_t k)
+    {
+        const size_t n = size_t{ 1 } << (k + 1);
+        GeneratedDFA dfa{ "suffix", 2, std::vector<bool>(n, false), {} };
+        for (RE::Index q = 0; q < n; ++q) {
+            dfa.accept[q] = (q >> k) & 1;
+            dfa.trans.push_back(RE::NumberedTransition{ q, 0, ((q << 1) | 1) & (n - 1) });
+            dfa.trans.push_back(RE::NumberedTransition{ q, 1, (q << 1) & (n - 1) });
+        }
+        return dfa;
+    }
+
+    size_t CountBlocks(std::vector<RE::Index> blocks)
+    {
+        std::sort(blocks.begin(), blocks.end());
+        return std::unique(blocks.begin(), blocks.end()) - blocks.begin();
+    }
+
+    double Measure(const std::function<void()>& f)
+    {
+        const auto begin = std::chrono::steady_clock::now();
+        f();
+        const auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - begin).count();
+    }
+
+    void Run(std::ostream& os, const GeneratedDFA& dfa, const bool withFixedPoint)
+    {
+        std::vector<RE::Index> hopcroft;
+        const double msHopcroft = Measure([&]() { hopcroft = RE::PartitionStates(dfa.accept, dfa.trans); });
+        os << std::setw(8) << dfa.family << std::setw(10) << dfa.accept.size() << std::setw(10) << dfa.trans.size()
+            << std::setw(10) << CountBlocks(hopcroft) << std::setw(14) << std::fixed << std::setprecision(2) << msHopcroft;
+        if (withFixedPoint) {
+            std::vector<RE::Index> fixedPoint;
+            const FixedPointPartition fp{ dfa };
+            const double msFixedPoint = Measure([&]() { fixedPoint = fp.Run(dfa.accept); });
+            os << std::setw(14) << msFixedPoint;
+            if (CountBlocks(fixedPoint) != CountBlocks(hopcroft)) {
+                os << "  MISMATCH: " << CountBlocks(fixedPoint) << " blocks";
+            }
+        }
+        else {
+            os << std::setw(14) << "-";
+        }
+        os << std::endl;
+    }
+}
+
+int main()
+{
+    try
+    {
+        using namespace RegexBenchmark;
+        std::cout << std::setw(8) << "family" << std::setw(10) << "states" << std::setw(10) << "trans"
+            << std::setw(10) << "blocks" << std::setw(14) << "Hopcroft, ms" << std::setw(14) << "fixed, ms" << std::endl;
+        for (const size_t n : { 1000, 4000, 8000 }) {
+            Run(std::cout, GenerateChain(n), true);
+        }
+        Run(std::cout, GenerateChain(1000000), false);
+        for (const size_t n : { 1000, 10000 }) {
+            Run(std::cout, GenerateRandom(n, 16, 0.5, 1), true);
+        }
+        Run(std::cout, GenerateRandom(100000, 16, 0.5, 1), false);
+        for (const size_t k : { 9, 12 }) {
+            Run(std::cout, GenerateSuffix(k), true);
+        }
+        Run(std::cout, GenerateSuffix(19), false);
+
+        return 0;
+    }
+    catch (const std::exception& e)
+    {
+        Error::ErrPrint(std::cerr, Error::Level::EXCEPTION, Error::Type::STD, e.what());
+        return -2;
+    }
+}
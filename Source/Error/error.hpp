@@ -42,6 +42,15 @@ namespace Error
         explicit InvalidRegex(const std::string& message) : ExceptionBase(message.c_str()) {}
         explicit InvalidRegex(const char* message) : ExceptionBase(message) {}
     };
+
+    // a regular expression needs more resources to compile than allowed
+    class CompileLimitExceeded : public InvalidRegex {
+    public:
+        using ExceptionBase = InvalidRegex;
+
+        explicit CompileLimitExceeded(const std::string& message) : ExceptionBase(message.c_str()) {}
+        explicit CompileLimitExceeded(const char* message) : ExceptionBase(message) {}
+    };
 }
 
 #endif // ERROR_HPP
@@ -9,18 +9,36 @@
 #include<sstream>
 #include<iomanip>
 #include<string>
+#include<cstring>
 #include<vector>
 #include<set>
+#include<map>
 #include<unordered_map>
+#include<unordered_set>
 #include<queue>
 #include<algorithm>
 #include<memory>
+#include<iterator>
+#include<functional>
 #include<cctype>
 #include<limits>
+#include<chrono>
+#include<atomic>
+#include<mutex>
+#include<shared_mutex>
+#include<thread>
+#include<exception>
 #include"regexpr_config.hpp"
 #include"../Error/error.hpp"
 #include"regexpr.hpp"
 
+#if REGEX_ENABLE_SSE2 && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include<emmintrin.h>
+#define REGEX_USE_SSE2 1
+#else
+#define REGEX_USE_SSE2 0
+#endif // REGEX_ENABLE_SSE2
+
 namespace RE
 {
     namespace Strings
@@ -64,60 +82,40 @@ namespace RE
     }
 
 
-    NFAnode* NFAnode::hint = nullptr;
-    std::allocator<NFAnode> NFA::alloc;
-
+    // the function returns the nodes in the depth-first order, the first node is the first one;
+    // the nodes are not changed, so the NFA may be traversed by several threads at once
     std::vector<NFAnode*> NFA::GetAllNodes() const
     {
         std::vector<NFAnode*> all;
         all.reserve(sz);
-        AddNodeToSet(all, first);
-        for (NFAnode* p : all) {
-            p->mark = false;
+        std::unordered_set<const NFAnode*> visited;
+        std::vector<NFAnode*> stack{ first };
+        while (stack.size() > 0) {
+            NFAnode* p = stack.back();
+            stack.pop_back();
+            if (p == nullptr || !visited.insert(p).second) {
+                continue;
+            }
+            all.push_back(p);
+            stack.push_back(p->succ2);
+            stack.push_back(p->succ1);
         }
         return all;
     }
 
-    void NFA::AddNodeToSet(std::vector<NFAnode*>& set, NFAnode* node) const
-    {
-        if (node == nullptr || node->mark == true) {
-            return;
-        }
-        set.push_back(node);
-        node->mark = true;
-        AddNodeToSet(set, node->succ1);
-        AddNodeToSet(set, node->succ2);
-    }
-
-    void NFA::ReleaseResources() const
+    NFAnode* NFA::CreateNFANode(const NFAnode::Type type)
     {
-        std::vector<NFAnode*> nodes = GetAllNodes();
-        for (NFAnode* p : nodes) {
-            alloc.destroy(p);
-            alloc.deallocate(p, 1);
-        }
+        return arena.Create(type);
     }
 
-    NFAnode* NFA::CreateNFANode(const NFAnode::Type type) const
+    NFAnode* NFA::CreateNFANode(const NFAnode::Type type, const Character character)
     {
-        NFAnode* p = alloc.allocate(1, NFAnode::hint);
-        if (p == nullptr) {
-            throw Error::RuntimeError{ "No memory allocated for NFA node" };
-        }
-        NFAnode::hint = p;
-        alloc.construct(p, type);
-        return p;
+        return arena.Create(type, character);
     }
 
-    NFAnode* NFA::CreateNFANode(const NFAnode::Type type, const Character character) const
+    NFAnode* NFA::CreateNFANode(const NFAnode::Type type, const CharacterRange& range)
     {
-        NFAnode* p = alloc.allocate(1, NFAnode::hint);
-        if (p == nullptr) {
-            throw Error::RuntimeError{ "No memory allocated for NFA node" };
-        }
-        alloc.construct(p, type, character);
-        NFAnode::hint = p;
-        return p;
+        return arena.Create(type, range);
     }
 
     NFA NFA::CreateCopy() const
@@ -129,7 +127,9 @@ namespace RE
         for (Index i = 0; i < nodes.size(); ++i) {
             const NFAnode* p = nodes[i];
             indexes.emplace(p, i);
-            nodeCopies.push_back(CreateNFANode(p->ty, p->ch));
+            nodeCopies.push_back(nfaCopy.CreateNFANode(p->ty, CharacterRange{ p->ch, p->chLast }));
+            nodeCopies[i]->minCount = p->minCount;
+            nodeCopies[i]->maxCount = p->maxCount;
             if (p->ty == NFAnode::Type::ACCEPT) {
                 nfaCopy.last = nodeCopies[i];
             }
@@ -151,6 +151,54 @@ namespace RE
         return nfaCopy;
     }
 
+    // the function returns true if each path from the first node to the last node has exactly one LITERAL node,
+    // that is the NFA matches one character of a class
+    bool NFA::IsCharacterClass() const
+    {
+        const std::vector<NFAnode*> nodes = GetAllNodes();
+        std::set<const NFAnode*> reached;
+        std::vector<const NFAnode*> stack;
+        auto reach = [&reached, &stack](const NFAnode* node) {
+            if (reached.insert(node).second) {
+                stack.push_back(node);
+            }
+        };
+        // Epsilon-closure of the nodes on the stack
+        auto close = [&reach, &stack]() {
+            while (stack.size() > 0) {
+                const NFAnode* p = stack.back();
+                stack.pop_back();
+                if (p->ty == NFAnode::Type::EPSILON) {
+                    reach(p->succ1);
+                    if (p->succ2 != nullptr) {
+                        reach(p->succ2);
+                    }
+                }
+            }
+        };
+        reach(first);
+        close();
+        if (reached.find(last) != reached.end()) {
+            return false;
+        }
+        reached.clear();
+        for (const NFAnode* p : nodes) {
+            if (p->ty == NFAnode::Type::COUNTER) {
+                return false;
+            }
+            if (p->ty == NFAnode::Type::LITERAL) {
+                reach(p->succ1);
+            }
+        }
+        close();
+        for (const NFAnode* p : reached) {
+            if (p->ty != NFAnode::Type::EPSILON && p != last) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     NFA::NFA(const Character character)
         : sz{ 2 }
     {
@@ -159,14 +207,16 @@ namespace RE
         first->succ1 = last;
     }
 
-    NFA::~NFA()
+    NFA::NFA(const CharacterRange& range)
+        : sz{ 2 }
     {
-        if (sz > 0) {
-            ReleaseResources();
-        }
+        first = CreateNFANode(NFAnode::Type::LITERAL, range);
+        last = CreateNFANode(NFAnode::Type::ACCEPT);
+        first->succ1 = last;
     }
 
     NFA::NFA(NFA&& other)
+        : arena{ std::move(other.arena) }
     {
         first = other.first;
         last = other.last;
@@ -180,9 +230,7 @@ namespace RE
         if (this == &other) {
             return *this;
         }
-        if (sz > 0) {
-            ReleaseResources();
-        }
+        arena = std::move(other.arena);
         first = other.first;
         last = other.last;
         sz = other.sz;
@@ -198,6 +246,7 @@ namespace RE
         last->ty = NFAnode::Type::EPSILON;
         last = other.last;
         sz += other.sz;
+        arena.Splice(other.arena);
         other.first = other.last = nullptr;
         other.sz = 0;
     }
@@ -215,6 +264,21 @@ namespace RE
         first = newFirst;
         last = newLast;
         sz += other.sz + 2;
+        arena.Splice(other.arena);
+        other.first = other.last = nullptr;
+        other.sz = 0;
+    }
+
+    // the function joins two NFAs under a new first node, the last node of 'other' stays an accept node,
+    // so the NFA has several accept nodes and its last node is the one of this NFA
+    void NFA::Join(NFA& other)
+    {
+        NFAnode* newFirst = CreateNFANode(NFAnode::Type::EPSILON);
+        newFirst->succ1 = first;
+        newFirst->succ2 = other.first;
+        first = newFirst;
+        sz += other.sz + 1;
+        arena.Splice(other.arena);
         other.first = other.last = nullptr;
         other.sz = 0;
     }
@@ -259,7 +323,8 @@ namespace RE
     }
 
     // the function creates a custom ({INT}, {INT,}, {MIN,MAX}) closure for NFA
-    // for {INT} INT >= 1; for {INT,} INT >= 0; for {MIN,MAX} MIN >= 0, MIN < MAX
+    // for {INT} INT >= 1; for {INT,} INT >= 0; for {MIN,MAX} MIN >= 0, MIN < MAX;
+    // the repetition of a character class is a COUNTER node, other NFAs are copied
     void NFA::ClosureCustom(const int min, const int max, const Constants::ClosureType ty)
     {
         switch (ty) {
@@ -267,6 +332,10 @@ namespace RE
             if (min < 1) {
                 throw Error::InvalidRegex{ "For {INT}, INT must be greater than or equal to 1" };
             }
+            if (min > 1 && IsCharacterClass()) {
+                ClosureCounted(min, min);
+                break;
+            }
             std::vector<NFA> copies;
             for (int i = 1; i < min; ++i) {
                 copies.push_back(CreateCopy());
@@ -286,6 +355,9 @@ namespace RE
             else if (min == 1) {
                 this->ClosurePositive();
             }
+            else if (IsCharacterClass()) {
+                ClosureCounted(min, -1);
+            }
             else {
                 std::vector<NFA> copies;
                 for (int i = 1; i < min; ++i) {
@@ -303,24 +375,37 @@ namespace RE
                 throw Error::InvalidRegex{ "For {MIN,MAX}, MIN must be greater than or equal to 0, "
                                            "MIN must be less than MAX" };
             }
+            if (IsCharacterClass()) {
+                ClosureCounted(min, max);
+                break;
+            }
             std::vector<NFA> copies;
             for (int i = 1; i < max; ++i) {
                 copies.push_back(CreateCopy());
             }
+            // an optional copy is skipped to the common last node, not to the next copy, so the Epsilon-closure
+            // of the end of a copy does not contain all the following copies
+            NFAnode* newLast = CreateNFANode(NFAnode::Type::ACCEPT);
+            auto makeOptional = [newLast](NFA& nfa) {
+                NFAnode* newFirst = nfa.CreateNFANode(NFAnode::Type::EPSILON);
+                newFirst->succ1 = nfa.first;
+                newFirst->succ2 = newLast;
+                nfa.first = newFirst;
+                nfa.sz += 1;
+            };
             if (min == 0) {
-                this->ClosureBinary();
-                for (size_t i = 0; i < copies.size(); ++i) {
-                    copies[i].ClosureBinary();
-                }
+                makeOptional(*this);
             }
-            else {
-                for (size_t i = min - 1; i < copies.size(); ++i) {
-                    copies[i].ClosureBinary();
-                }
+            for (size_t i = (min == 0) ? 0 : min - 1; i < copies.size(); ++i) {
+                makeOptional(copies[i]);
             }
             for (NFA& nfa : copies) {
                 this->Concatenate(nfa);
             }
+            last->succ1 = newLast;
+            last->ty = NFAnode::Type::EPSILON;
+            last = newLast;
+            sz += 1;
             break;
         }
         default:
@@ -328,1303 +413,4295 @@ namespace RE
         }
     }
 
-    ///----------------------------------------------------------------------------------------------------
-
-    DFAnode* DFAnode::hint = nullptr;
-    std::allocator<DFAnode> DFA::alloc;
-
-    std::vector<DFAnode*> DFA::GetAllNodes() const
-    {
-        std::vector<DFAnode*> all;
-        all.reserve(sz);
-        AddNodeToSet(all, first);
-        for (DFAnode* p : all) {
-            p->mark = false;
-        }
-        return all;
-    }
-
-    void DFA::AddNodeToSet(std::vector<DFAnode*>& set, DFAnode* node) const
+    // the function returns the number of nodes of the NFA after ClosureCustom, the NFA is not changed
+    size_t NFA::CustomClosureSize(const int min, const int max, const Constants::ClosureType ty) const
     {
-        if (node == nullptr || node->mark == true) {
-            return;
+        if (min < 0 || (ty == Constants::ClosureType::RANGE && min >= max)) {
+            return sz;
         }
-        set.push_back(node);
-        node->mark = true;
-        for (auto& t : node->trans) {
-            AddNodeToSet(set, t.second);
+        switch (ty) {
+        case Constants::ClosureType::FINITE:
+            if (min <= 1) {
+                return sz;
+            }
+            return IsCharacterClass() ? sz + 2 : sz * min;
+        case Constants::ClosureType::INFITITE:
+            if (min <= 1 || IsCharacterClass()) {
+                return sz + 2;
+            }
+            return sz * min + 2;
+        case Constants::ClosureType::RANGE:
+            if (IsCharacterClass()) {
+                return sz + ((min == 0) ? 3 : 2);
+            }
+            return sz * max + (max - min) + 1;
+        default:
+            return sz;
         }
     }
 
-    void DFA::ReleaseResources() const
+    // the function replaces the NFA of a character class with a COUNTER node that repeats the class from 'min'
+    // to 'max' times ('max' is -1 if the repetition is unbounded), the class is kept at the second successor of
+    // the node and its last node leads back to the node
+    void NFA::ClosureCounted(const int min, const int max)
     {
-        std::vector<DFAnode*> nodes = GetAllNodes();
-        for (DFAnode* p : nodes) {
-            alloc.destroy(p);
-            alloc.deallocate(p, 1);
+        NFAnode* counter = CreateNFANode(NFAnode::Type::COUNTER);
+        NFAnode* newLast = CreateNFANode(NFAnode::Type::ACCEPT);
+        counter->succ1 = newLast;
+        counter->succ2 = first;
+        counter->minCount = min;
+        counter->maxCount = max;
+        last->succ1 = counter;
+        last->ty = NFAnode::Type::EPSILON;
+        first = counter;
+        last = newLast;
+        sz += 2;
+        if (min == 0) {
+            NFAnode* newFirst = CreateNFANode(NFAnode::Type::EPSILON);
+            newFirst->succ1 = counter;
+            newFirst->succ2 = newLast;
+            first = newFirst;
+            sz += 1;
         }
     }
 
-    DFAnode* DFA::CreateDFANode(const bool accept) const
-    {
-        DFAnode* p = alloc.allocate(1, DFAnode::hint);
-        if (p == nullptr) {
-            throw Error::RuntimeError{ "No memory allocated for DFA node" };
-        }
-        DFAnode::hint = p;
-        alloc.construct(p, accept);
-        return p;
-    }
+    ///----------------------------------------------------------------------------------------------------
 
-    bool operator==(const DFA& left, const DFA& right)
-    {
-        if (left.sz != right.sz) {
-            return false;
-        }
-        if (left.first == nullptr && right.first == nullptr) {
-            return true;
-        }
-        std::set<const DFAnode*> visited;
-        if (left.first == nullptr || right.first == nullptr || !Equal(left.first, right.first, visited)) {
-            return false;
-        }
-        return true;
-    }
+    constexpr Index IndexedNFA::none;
 
-    bool Equal(const DFAnode* left, const DFAnode* right, std::set<const DFAnode*>& visited)
+    IndexedNFA::IndexedNFA(const NFA& nfa)
     {
-        visited.emplace(left);
-        if (left->acc != right->acc || left->mark != right->mark) {
-            return false;
-        }
-        if (left->trans.size() != right->trans.size()) {
-            return false;
+        // the nodes are numbered in the depth-first order, the character class of a COUNTER node is not visited
+        std::unordered_map<const NFAnode*, Index> indexes;
+        std::vector<const NFAnode*> stack;
+        auto visit = [&indexes, &stack, this](const NFAnode* node) {
+            if (node != nullptr && indexes.emplace(node, nodes.size()).second) {
+                nodes.push_back(node);
+                stack.push_back(node);
+            }
+        };
+        visit(nfa.GetFirstNode());
+        while (stack.size() > 0) {
+            const NFAnode* p = stack.back();
+            stack.pop_back();
+            if (p->ty != NFAnode::Type::COUNTER) {
+                visit(p->succ2);
+            }
+            visit(p->succ1);
         }
-        for (size_t i = 0; i < left->trans.size(); ++i) {
-            if (left->trans[i].first != right->trans[i].first) {
-                return false;
+        succ1.resize(nodes.size(), none);
+        succ2.resize(nodes.size(), none);
+        sz = nodes.size();
+        std::vector<Index> position0(nodes.size(), none);
+        for (Index i = 0; i < nodes.size(); ++i) {
+            const NFAnode* p = nodes[i];
+            if (p->succ1 != nullptr) {
+                succ1[i] = indexes.find(p->succ1)->second;
             }
-            if (visited.find(left->trans[i].second) == visited.end()) {
-                if (!Equal(left->trans[i].second, right->trans[i].second, visited)) {
-                    return false;
+            if (p->ty == NFAnode::Type::COUNTER) {
+                Counter c{ i, sz, 0, 0, false, {} };
+                if (p->maxCount < 0) {
+                    c.size = p->minCount;
+                    c.min = p->minCount;
+                    c.loop = true;
+                }
+                else {
+                    c.size = p->maxCount;
+                    c.min = std::max(p->minCount, 1);
+                }
+                // the class is a tree of Epsilon nodes with LITERAL leaves
+                std::vector<const NFAnode*> classNodes{ p->succ2 };
+                while (classNodes.size() > 0) {
+                    const NFAnode* q = classNodes.back();
+                    classNodes.pop_back();
+                    if (q->ty == NFAnode::Type::LITERAL) {
+                        c.ranges.push_back(CharacterRange{ q->ch, q->chLast });
+                        continue;
+                    }
+                    classNodes.push_back(q->succ1);
+                    if (q->succ2 != nullptr) {
+                        classNodes.push_back(q->succ2);
+                    }
                 }
+                position0[i] = c.first;
+                sz += c.size;
+                counters.push_back(std::move(c));
+            }
+            else if (p->succ2 != nullptr) {
+                succ2[i] = indexes.find(p->succ2)->second;
             }
         }
-        return true;
-    }
+        first = indexes.find(nfa.GetFirstNode())->second;
+        last = indexes.find(nfa.GetLastNode())->second;
 
-    DFA::~DFA()
-    {
-        if (sz > 0) {
-            ReleaseResources();
+        // Epsilon-closure of each node, computed once by an iterative traversal
+        SparseSet reached{ nodes.size() };
+        std::vector<Index> indexStack;
+        closureFirst.reserve(nodes.size() + 1);
+        for (Index i = 0; i < nodes.size(); ++i) {
+            closureFirst.push_back(closure.size());
+            reached.Insert(i);
+            indexStack.push_back(i);
+            while (indexStack.size() > 0) {
+                const Index k = indexStack.back();
+                indexStack.pop_back();
+                if (nodes[k]->ty != NFAnode::Type::EPSILON) {
+                    continue;
+                }
+                if (reached.Insert(succ1[k])) {
+                    indexStack.push_back(succ1[k]);
+                }
+                if (succ2[k] != none && reached.Insert(succ2[k])) {
+                    indexStack.push_back(succ2[k]);
+                }
+            }
+            // Epsilon nodes have no transitions on characters and are never the last node,
+            // so they do not affect the DFA state
+            for (const Index k : reached) {
+                if (nodes[k]->ty == NFAnode::Type::COUNTER) {
+                    closure.push_back(position0[k]);
+                }
+                else if (nodes[k]->ty != NFAnode::Type::EPSILON) {
+                    closure.push_back(k);
+                }
+            }
+            std::sort(closure.begin() + closureFirst.back(), closure.end());
+            reached.Clear();
         }
+        closureFirst.push_back(closure.size());
     }
 
-    DFA::DFA(DFA&& other)
+    // the function returns the index of the counter of 'position' in 'counters'
+    Index IndexedNFA::CounterIndex(const Index position) const
     {
-        first = other.first;
-        sz = other.sz;
-        other.first = nullptr;
-        other.sz = 0;
+        auto it = std::upper_bound(counters.begin(), counters.end(), position,
+            [](const Index i, const Counter& c) { return i < c.first; });
+        return (it - counters.begin()) - 1;
     }
 
-    DFA& DFA::operator=(DFA&& other)
+    size_t StateSetHash::operator()(const StateSet& set) const
     {
-        if (this == &other) {
-            return *this;
-        }
-        if (sz > 0) {
-            ReleaseResources();
+        size_t h = set.size();
+        for (const Index i : set) {
+            h ^= std::hash<Index>{}(i) + 0x9E3779B9 + (h << 6) + (h >> 2);
         }
-        first = other.first;
-        sz = other.sz;
-        other.first = nullptr;
-        other.sz = 0;
-        return *this;
+        return h;
     }
 
     ///----------------------------------------------------------------------------------------------------
 
-    // 1 substring == 1 sequence of tokens from which 1 atom is created
-    // qty == the quantity of last atoms for which the total substring will be obtained 
-    UString Regexp::TokenStream::GetSubstring(const size_t qty) const
+    constexpr StateIndex LazyDFA::dead;
+    constexpr StateIndex LazyDFA::start;
+    constexpr StateIndex LazyDFA::unknown;
+    constexpr size_t LazyDFA::maxBlockSize;
+
+    // 'alphabet' is the partition of the characters of the NFA, so the range of each node is a union
+    // of consecutive ranges of the alphabet
+    LazyDFA::LazyDFA(const IndexedNFA& inf, const std::vector<CharacterRange>& alphabet, const size_t cacheSize)
+        : nClasses{ alphabet.size() + 1 }, counters{ inf.counters }, nNodes{ inf.nodes.size() }, last{ inf.last },
+        cacheSize{ std::max(cacheSize, Constants::minLazyCacheSize) }
     {
-        UString s;
-        if (tss.size() == 0 || qty == 0) {
-            return s;
+        std::vector<ClassRange> ranges;
+        for (Index k = 0; k < alphabet.size(); ++k) {
+            ranges.push_back(ClassRange{ alphabet[k], static_cast<ClassIndex>(k + 1) });
         }
-        int i = tpos;
-        int counter = qty;
-        while (counter > 0) {
-            --counter;
-            i = (i <= 0) ? tss.size() - 1 : i - 1;
+        classes = CharacterClassMap{ ranges };
+        // the classes of the characters [ch, chLast]
+        auto findClasses = [&alphabet](const Character ch, const Character chLast) {
+            auto it = std::lower_bound(alphabet.begin(), alphabet.end(), ch,
+                [](const CharacterRange& r, const Character ch) { return r.second < ch; });
+            const ClassIndex firstCl = static_cast<ClassIndex>(it - alphabet.begin() + 1);
+            it = std::lower_bound(it, alphabet.end(), chLast,
+                [](const CharacterRange& r, const Character ch) { return r.second < ch; });
+            return std::make_pair(firstCl, static_cast<ClassIndex>(it - alphabet.begin() + 1));
+        };
+        counterClasses.resize(counters.size() * nClasses, false);
+        for (Index k = 0; k < counters.size(); ++k) {
+            for (const CharacterRange& r : counters[k].ranges) {
+                const std::pair<ClassIndex, ClassIndex> cls = findClasses(r.first, r.second);
+                for (ClassIndex cl = cls.first; cl <= cls.second; ++cl) {
+                    counterClasses[k * nClasses + cl] = true;
+                }
+            }
         }
-        while (counter < qty) {
-            ++counter;
-            s += tss[i];
-            i = (i == tss.size() - 1) ? 0 : i + 1;
+        firstClass.resize(nNodes, 1);
+        lastClass.resize(nNodes, 0);
+        // the predecessors of position 0 of a counter are kept with its COUNTER node
+        std::vector<std::vector<Index>> predecessors(nNodes);
+        closureFirst.reserve(nNodes + 1);
+        for (Index i = 0; i < nNodes; ++i) {
+            closureFirst.push_back(closure.size());
+            const NFAnode* p = inf.nodes[i];
+            if (p->ty == NFAnode::Type::LITERAL) {
+                const std::pair<ClassIndex, ClassIndex> cls = findClasses(p->ch, p->chLast);
+                firstClass[i] = cls.first;
+                lastClass[i] = cls.second;
+            }
+            else if (p->ty != NFAnode::Type::COUNTER) {
+                continue;
+            }
+            // the closure of the successor of a COUNTER node is the one of its positions
+            const Index pred = (p->ty == NFAnode::Type::COUNTER) ? *inf.ClosureBegin(i) : i;
+            closure.insert(closure.end(), inf.ClosureBegin(inf.succ1[i]), inf.ClosureEnd(inf.succ1[i]));
+            for (const Index* k = inf.ClosureBegin(inf.succ1[i]); k != inf.ClosureEnd(inf.succ1[i]); ++k) {
+                predecessors[inf.IsPosition(*k) ? counters[CounterIndex(*k)].node : *k].push_back(pred);
+            }
         }
-        return s;
-    }
-
-    inline Regexp::TokenStream::TokenType Regexp::TokenStream::GetTokenType(const Character ch) const
-    {
-        switch (ch) {
-        case SPEC_LPAR:
-        case SPEC_RPAR:
-        case SPEC_STAR:
-        case SPEC_PLUS:
-        case SPEC_DOT:
-        case SPEC_QUESTION:
-        case SPEC_LBRACKET:
-        case SPEC_BSLASH:
-        case SPEC_RBRACKET:
-        case SPEC_LBRACE:
-        case SPEC_BAR:
-        case SPEC_RBRACE:
-            return TokenType::SPECIAL;
-        default:
-            return TokenType::LITERAL;
+        closureFirst.push_back(closure.size());
+        predsFirst.reserve(nNodes + 1);
+        for (const std::vector<Index>& p : predecessors) {
+            predsFirst.push_back(preds.size());
+            preds.insert(preds.end(), p.begin(), p.end());
         }
+        predsFirst.push_back(preds.size());
+        first.assign(inf.ClosureBegin(inf.first), inf.ClosureEnd(inf.first));
+        identity = std::make_shared<int>(0);
     }
 
-    inline std::pair<Character, Regexp::TokenStream::TokenType> Regexp::TokenStream::GetToken() const
+    // the function returns the index of the counter of 'position' in 'counters'
+    Index LazyDFA::CounterIndex(const Index position) const
     {
-        if (pos >= s.size()) {
-            return { Constants::notCharacter, TokenType::EOS };
-        }
-        const Character ch = s[pos];
-        return { ch, GetTokenType(ch) };
+        auto it = std::upper_bound(counters.begin(), counters.end(), position,
+            [](const Index i, const IndexedNFA::Counter& c) { return i < c.first; });
+        return (it - counters.begin()) - 1;
     }
 
-    std::set<const NFAnode*> Regexp::Delta(const std::set<const NFAnode*>& set, const Character ch) const
+    // the function adds the nodes and the positions that have a transition on the class 'cl' after which
+    // 'node' is reached to 'set'
+    void LazyDFA::AddPredecessors(const Index node, const ClassIndex cl, StateSet& set) const
     {
-        std::set<const NFAnode*> newSet;
-        for (const NFAnode* p : set) {
-            if (p->ty == NFAnode::Type::LITERAL && p->ch == ch) {
-                newSet.emplace(p->succ1);
+        Index key = node;
+        if (node >= nNodes) {
+            const Index k = CounterIndex(node);
+            const IndexedNFA::Counter& c = counters[k];
+            const Index v = node - c.first;
+            if (HasClass(k, cl)) {
+                if (v > 0) {
+                    set.push_back(node - 1);
+                }
+                if (c.loop && v + 1 == c.size) {
+                    set.push_back(node);
+                }
+            }
+            if (v > 0) {
+                return;
             }
+            key = c.node;
         }
-        return newSet;
-    }
-
-    std::set<const NFAnode*> Regexp::EpsilonClosure(const std::set<const NFAnode*>& set) const
-    {
-        std::set<const NFAnode*> newSet{ set.begin(), set.end() };
-        for (const NFAnode* p : set) {
-            AddNodesReachableViaEpsilonTransition(newSet, p);
+        for (Index i = predsFirst[key]; i < predsFirst[key + 1]; ++i) {
+            const Index p = preds[i];
+            if (p < nNodes) {
+                if (firstClass[p] <= cl && cl <= lastClass[p]) {
+                    set.push_back(p);
+                }
+                continue;
+            }
+            const Index k = CounterIndex(p);
+            if (HasClass(k, cl)) {
+                const IndexedNFA::Counter& c = counters[k];
+                for (Index v = c.min - 1; v < c.size; ++v) {
+                    set.push_back(c.first + v);
+                }
+            }
         }
-        return newSet;
     }
 
-    void Regexp::AddNodesReachableViaEpsilonTransition(std::set<const NFAnode*>& set, const NFAnode* node) const
+    // a forward state is live if the last node is reachable from its nodes on the characters from the current
+    // position onwards: it contains the last node or a node of the backward state of the position
+    bool LazyDFA::IsLive(const LazyCache& c, const StateIndex state, const StateIndex backwardState) const
     {
-        if (node->ty == NFAnode::Type::EPSILON) {
-            set.emplace(node->succ1);
-            AddNodesReachableViaEpsilonTransition(set, node->succ1);
-            if (node->succ2 != nullptr) {
-                set.emplace(node->succ2);
-                AddNodesReachableViaEpsilonTransition(set, node->succ2);
+        if (IsAccept(c, state)) {
+            return true;
+        }
+        const StateSet& a = c.forward.sets[state];
+        const StateSet& b = c.backward.sets[backwardState];
+        auto i = a.begin();
+        auto k = b.begin();
+        while (i != a.end() && k != b.end()) {
+            if (*i < *k) {
+                ++i;
+            }
+            else if (*k < *i) {
+                ++k;
+            }
+            else {
+                return true;
             }
         }
+        return false;
     }
 
-    bool Regexp::Equal(const std::set<const NFAnode*>& a, const std::set<const NFAnode*>& b) const
+    // the function clears the caches of 'c' if they hold the states of another DFA
+    void LazyDFA::Prepare(LazyCache& c) const
     {
-        if (a.size() != b.size()) {
-            return false;
-        }
-        std::set<const NFAnode*>::const_iterator itA = a.begin();
-        std::set<const NFAnode*>::const_iterator itB = b.begin();
-        while (itA != a.end()) {
-            if (*itA != *itB) {
-                return false;
-            }
-            ++itA;
-            ++itB;
+        if (c.owner == identity) {
+            return;
         }
-        return true;
+        c = LazyCache{};
+        c.owner = identity;
+        c.forward.isForward = true;
+        c.unanchored.isForward = true;
+        Clear(c.forward);
+        Clear(c.backward);
+        Clear(c.unanchored);
     }
 
-    std::pair<std::vector<DFAnode*>, std::vector<DFAnode*>> Regexp::Split(const std::vector<DFAnode*>& set,
-        const std::unordered_map<const DFAnode*, Index>& indexes) const
+    // the function adds the nodes reached from 'set' on the class 'cl' to 'reached', sorted and without repeats
+    void LazyDFA::Successors(const StateSet& set, const ClassIndex cl, StateSet& reached) const
     {
-        std::vector<DFAnode*> first;
-        std::vector<DFAnode*> second;
-        for (const Character ch : alphabet) {
-            std::vector<const DFAnode*> trans;                  // transition to node on current ch
-            trans.reserve(set.size());
-            for (const DFAnode* p : set) {
-                trans.push_back(FindTransition(p, ch));
-            }
-            first.clear();
-            const bool target = TransitionExists(trans[0]);
-            for (Index i = 0; i < set.size(); ++i) {
-                if (target == TransitionExists(trans[i])) {
-                    first.push_back(set[i]);
-                }
-                else {
-                    second.push_back(set[i]);
+        for (const Index i : set) {
+            if (i < nNodes) {
+                if (firstClass[i] <= cl && cl <= lastClass[i]) {
+                    reached.insert(reached.end(), closure.begin() + closureFirst[i], closure.begin() + closureFirst[i + 1]);
                 }
+                continue;
             }
-            if (second.size() != 0) {
-                return { first, second };
-            }
-            if (target == false) {
+            const Index k = CounterIndex(i);
+            if (!HasClass(k, cl)) {
                 continue;
             }
-            first.clear();
-            const Index targetNum = indexes.find(trans[0])->second;
-            for (Index i = 0; i < set.size(); ++i) {
-                if (targetNum == indexes.find(trans[i])->second) {
-                    first.push_back(set[i]);
-                }
-                else {
-                    second.push_back(set[i]);
-                }
+            const IndexedNFA::Counter& counter = counters[k];
+            const Index v = i - counter.first;
+            if (v + 1 < counter.size) {
+                reached.push_back(i + 1);
             }
-            if (second.size() != 0) {
-                return { first, second };
+            else if (counter.loop) {
+                reached.push_back(i);
+            }
+            if (v + 1 >= counter.min) {
+                reached.insert(reached.end(),
+                    closure.begin() + closureFirst[counter.node], closure.begin() + closureFirst[counter.node + 1]);
             }
         }
-        return { set, second };
+        std::sort(reached.begin(), reached.end());
+        reached.erase(std::unique(reached.begin(), reached.end()), reached.end());
     }
 
-    const DFAnode* Regexp::FindTransition(const DFAnode* node, const Character ch) const
+    StateIndex LazyDFA::Forward(LazyCache& c, const StateIndex state, const Character ch) const
     {
-        TransitionTable::const_iterator it =
-            std::lower_bound(node->trans.begin(), node->trans.end(), ch, LessTransitionCharacter{});
-        if (it == node->trans.end() || it->first != ch) {
-            return nullptr;
-        }
-        else {
-            return it->second;
-        }
+        return Transition(c, state, ch, false);
     }
 
-    void Regexp::AssignNumber(const std::vector<DFAnode*>& set, const Index num,
-        std::unordered_map<const DFAnode*, Index>& indexes) const
+    // the states of the unanchored search also hold the first node, so a match may begin at each position
+    StateIndex LazyDFA::ForwardUnanchored(LazyCache& c, const StateIndex state, const Character ch) const
     {
-        for (const DFAnode* p : set) {
-            indexes[p] = num;
-        }
+        return Transition(c, state, ch, true);
     }
 
-    DFA Regexp::CreateMinimalDFA(const SetPartition& sp,
-        const std::unordered_map<const DFAnode*, Index>& indexes) const
+    StateIndex LazyDFA::Transition(LazyCache& c, const StateIndex state, const Character ch, const bool unanchored) const
     {
-        DFAnode::hint = nullptr;
-        std::vector<DFAnode*> nodes;
-        nodes.reserve(sp.size());
-        for (const std::vector<DFAnode*>& set : sp) {
-            nodes.push_back(dfa.CreateDFANode(set[0]->acc));
+        Cache& cache = unanchored ? c.unanchored : c.forward;
+        const ClassIndex cl = classes[ch];
+        StateIndex& next = cache.trans[state * nClasses + cl];
+        if (next != unknown) {
+            return next;
         }
-        for (Index i = 0; i < sp.size(); ++i) {
-            for (const Transition& t : sp[i][0]->trans) {
-                nodes[i]->trans.push_back(Transition{ t.first, nodes[indexes.find(t.second)->second] });
-            }
+        StateSet& reached = c.reached;
+        Successors(cache.sets[state], cl, reached);
+        if (unanchored) {
+            reached.insert(reached.end(), first.begin(), first.end());
+            std::sort(reached.begin(), reached.end());
+            reached.erase(std::unique(reached.begin(), reached.end()), reached.end());
         }
-        DFA newDFA;
-        newDFA.first = nodes[indexes.find(dfa.first)->second];
-        newDFA.sz = nodes.size();
-        return newDFA;
+        StateSet set{ reached };
+        reached.clear();
+        const size_t generation = cache.generation;
+        const StateIndex target = Insert(cache, std::move(set));
+        // 'state' is not in the cache if it has been cleared
+        if (cache.generation == generation) {
+            cache.trans[state * nClasses + cl] = target;
+        }
+        return target;
     }
 
-    void RE::Regexp::CheckNFA() const
+    StateIndex LazyDFA::Backward(LazyCache& c, const StateIndex state, const Character ch) const
     {
-        std::set<const NFAnode*> set;
-        AddNodesReachableViaEpsilonTransition(set, nfa.GetFirstNode());
-        if (set.find(nfa.GetLastNode()) != set.end()) {
-            ThrowInvalidRegex("This regular expression is invalid. It matches any string");
+        const ClassIndex cl = classes[ch];
+        StateIndex& next = c.backward.trans[state * nClasses + cl];
+        if (next != unknown) {
+            return next;
         }
-    }
-    
-    // returns a pointer to the 'DFAnode' if there is a transition for this character,
-    // otherwise it returns 'nullptr'
-    inline DFAnode* Regexp::TakeStepThroughDFA(const DFAnode* current, const Character ch) const
-    {
-        return const_cast<DFAnode*>(FindTransition(current, ch));
-    }
-    
-    // returns an array of 'DFAnode' pointers if there is a transition for this character,
-    // otherwise it returns an empty array
-    std::vector<DFAnode*> Regexp::TakeStepThroughDFA(std::vector<DFAnode*>& currentState, const Character ch) const
-    {
-        constexpr size_t defaultSize = 8;
-        std::vector<DFAnode*> transitions;
-        transitions.reserve(defaultSize);
-        for (const DFAnode* p : currentState) {
-            DFAnode* node = const_cast<DFAnode*>(FindTransition(p, ch));
-            if (node) {
-                transitions.push_back(node);
-            }
-            TransitionTable::const_iterator itBeg =
-                std::lower_bound(p->trans.begin(), p->trans.end(), Constants::firstNegated, LessTransitionCharacter{});
-            if (itBeg != p->trans.end()) {
-                auto it = itBeg;
-                std::vector<DFAnode*> negated;
-                negated.reserve(defaultSize);
-                while (it != p->trans.end()) {
-                    negated.push_back(it->second);
-                    ++it;
-                }
-                std::sort(negated.begin(), negated.end());
-                DFAnode* excluded = const_cast<DFAnode*>(FindTransition(p, FLAGS_SET(ch, CHARFL_NEGATED)));
-                DFAnode* prev = nullptr;
-                for (DFAnode* cur : negated) {
-                    if (prev != cur) {
-                        if (cur != excluded) {
-                            transitions.push_back(cur);
-                        }
-                        prev = cur;
-                    }
-                }
-            }
+        StateSet& reached = c.reached;
+        AddPredecessors(last, cl, reached);
+        for (const Index i : c.backward.sets[state]) {
+            AddPredecessors(i, cl, reached);
+        }
+        std::sort(reached.begin(), reached.end());
+        reached.erase(std::unique(reached.begin(), reached.end()), reached.end());
+        StateSet set{ reached };
+        reached.clear();
+        const size_t generation = c.backward.generation;
+        const StateIndex target = Insert(c.backward, std::move(set));
+        if (c.backward.generation == generation) {
+            c.backward.trans[state * nClasses + cl] = target;
         }
-        return transitions;
+        return target;
     }
 
-    inline bool Regexp::IsNewLineSymbol(const Character ch) const
+    // the function replaces each of the distinct forward 'states' with its successor on 'ch', each successor
+    // may add a state to the cache, so if the cache may be cleared meanwhile, the successors are found from
+    // the copies of the sets of the states and the cache is cleared first; then all of them are added to it,
+    // even if there are more than 'cacheSize' of them, and the next new state clears it
+    void LazyDFA::Step(LazyCache& c, std::vector<StateIndex>& states, const Character ch) const
     {
-        switch (ch) {
-        case CTRL_LF:
-        case CTRL_CR:
-        case CTRL_LS:
-        case CTRL_PS:
-            return true;
-        default:
-            return false;
+        if (c.forward.sets.size() + states.size() <= cacheSize) {
+            for (StateIndex& state : states) {
+                state = Forward(c, state, ch);
+            }
+            return;
+        }
+        const ClassIndex cl = classes[ch];
+        std::vector<StateSet> next(states.size());
+        for (size_t k = 0; k < states.size(); ++k) {
+            Successors(c.forward.sets[states[k]], cl, next[k]);
+        }
+        Clear(c.forward);
+        for (size_t k = 0; k < states.size(); ++k) {
+            const auto it = c.forward.states.find(next[k]);
+            states[k] = (it != c.forward.states.end()) ? it->second : Add(c.forward, std::move(next[k]));
         }
     }
 
-    inline void Regexp::AdjustPositions(
-        std::u32string::const_iterator begin,
-        std::u32string::const_iterator end,
-        size_t& line,
-        size_t& pos) const
+    // the function returns the backward state of 'set', the cache is cleared first if fewer than 'room' states
+    // can be added to it, so the next 'room' - 1 new states do not clear it
+    StateIndex LazyDFA::BackwardState(LazyCache& c, const StateSet& set, const size_t room) const
     {
-        while (begin != end) {
-            if (IsNewLineSymbol(*begin)) {
-                ++line;
-                pos = 1;
-            }
-            else {
-                ++pos;
+        if (c.backward.sets.size() + room > cacheSize) {
+            Clear(c.backward);
+        }
+        return Insert(c.backward, StateSet{ set });
+    }
+
+    // the function returns the state of 'set', a new state is added to the cache, if the cache is full
+    // it is cleared first
+    StateIndex LazyDFA::Insert(Cache& cache, StateSet&& set) const
+    {
+        auto it = cache.states.find(set);
+        if (it != cache.states.end()) {
+            return it->second;
+        }
+        if (cache.sets.size() >= cacheSize) {
+            Clear(cache);
+            it = cache.states.find(set);
+            if (it != cache.states.end()) {
+                return it->second;
             }
-            ++begin;
         }
+        return Add(cache, std::move(set));
     }
 
-#if REGEX_PRINT_FA_STATE
-    void Regexp::MakeDFA()
+    // the function adds the state of 'set' that is not in the cache
+    StateIndex LazyDFA::Add(Cache& cache, StateSet&& set) const
     {
-        std::cout << std::endl << "RE: " << GetGlyph(this->source) << std::endl;
-        REtoNFA();
-        PrintNFA(std::cout, *this);
-        std::vector<DFAnode*> nodes = NFAtoDFA();
-        std::cout << std::endl << "RE: " << GetGlyph(this->source) << std::endl;
-        PrintDFA(std::cout, *this);
-        MinimizeDFA(nodes);
-        std::cout << std::endl << "RE: " << GetGlyph(this->source) << std::endl;
-        PrintDFA(std::cout, *this);
-        SetFlags();
+        const StateIndex state = static_cast<StateIndex>(cache.sets.size());
+        cache.states.emplace(set, state);
+        cache.sets.push_back(std::move(set));
+        cache.trans.resize(cache.trans.size() + nClasses, unknown);
+        return state;
     }
-#else
-    void Regexp::MakeDFA()
+
+    // the cache keeps the empty set and the forward cache also keeps the set of the first node
+    void LazyDFA::Clear(Cache& cache) const
     {
-        REtoNFA();
-        MinimizeDFA(NFAtoDFA());
-        SetFlags();
+        cache.sets.clear();
+        cache.states.clear();
+        cache.trans.clear();
+        ++cache.generation;
+        Insert(cache, StateSet{});
+        if (cache.isForward) {
+            Insert(cache, StateSet{ first });
+        }
     }
-#endif // REGEX_PRINT_FA_STATE
 
-    // Thompsons Construction
-    // CHAPTER 2 Scanners, 2.4 FROM REGULAR EXPRESSION TO SCANNER, 2.4.2 Regular Expression to NFA: Thompsons Construction
-    void Regexp::REtoNFA()
+    // the states are kept in the caches of the threads, so they are not counted
+    size_t LazyDFA::MemoryUsage() const
     {
-        nfa = PGoal();
-        if (token.second != Regexp::TokenStream::TokenType::EOS) {
-            ThrowInvalidRegexCharacter(ts.GetPosition());
+        size_t size = classes.MemoryUsage() + first.capacity() * sizeof(Index) + counterClasses.capacity() / 8;
+        size += (firstClass.capacity() + lastClass.capacity()) * sizeof(ClassIndex);
+        size += (closure.capacity() + closureFirst.capacity() + preds.capacity() + predsFirst.capacity()) * sizeof(Index);
+        for (const IndexedNFA::Counter& c : counters) {
+            size += sizeof(c) + c.ranges.capacity() * sizeof(CharacterRange);
         }
-        CheckNFA();
-        alphabet.insert(alphabet.end(), alphabetTemp.begin(), alphabetTemp.end());
-        std::sort(alphabet.begin(), alphabet.end());
-        alphabetTemp.clear();
+        return size;
     }
 
-    // Subset Construction
-    // CHAPTER 2 Scanners, 2.4 FROM REGULAR EXPRESSION TO SCANNER, 2.4.3 NFA to DFA: The Subset Construction
-    // FIGURE 2.6 The Subset Construction
-    std::vector<DFAnode*> Regexp::NFAtoDFA()
+    ///----------------------------------------------------------------------------------------------------
+
+    // the function returns the nodes in the depth-first order, the first node is the first one
+    std::vector<DFAnode*> DFA::GetAllNodes() const
     {
-        SubsetTableEntry first{ EpsilonClosure(std::set<const NFAnode*>{ {nfa.GetFirstNode()} }),
-            std::vector<SubsetTableIndex>(alphabet.size(), noTransition) };
-        SubsetTable table;
-        table.push_back(first);
-        std::queue<SubsetTableIndex> workList;
-        workList.push(0);
-        while (workList.size() > 0) {
-            SubsetTableIndex i = workList.front();
-            workList.pop();
-            for (size_t k = 0; k < alphabet.size(); ++k) {
-                const std::set<const NFAnode*> newSet = EpsilonClosure(Delta(table[i].state, alphabet[k]));
-                if (newSet.size() == 0) {
-                    continue;
-                }
-                bool inTable = false;
-                for (SubsetTableIndex j = 0; j < table.size(); ++j) {
-                    if (Equal(table[j].state, newSet)) {
-                        table[i].trans[k] = j;
-                        inTable = true;
-                    }
-                }
-                if (inTable == false) {
-                    SubsetTableEntry newEntry{ newSet,
-                        std::vector<SubsetTableIndex>(alphabet.size(), noTransition) };
-                    table.push_back(newEntry);
-                    SubsetTableIndex newIndex = table.size() - 1;
-                    workList.push(newIndex);
-                    table[i].trans[k] = newIndex;
-                }
+        std::vector<DFAnode*> all;
+        all.reserve(sz);
+        std::unordered_set<const DFAnode*> visited;
+        std::vector<DFAnode*> stack{ first };
+        while (stack.size() > 0) {
+            DFAnode* p = stack.back();
+            stack.pop_back();
+            if (p == nullptr || !visited.insert(p).second) {
+                continue;
             }
-        }
-        std::vector<DFAnode*> nodes;
-        nodes.reserve(table.size());
-        NFAnode* accepted = nfa.GetLastNode();
-        for (SubsetTableEntry& entry : table) {
-            std::set<const NFAnode*>::iterator it = entry.state.find(accepted);
-            nodes.push_back(dfa.CreateDFANode((it == entry.state.end()) ? false : true));
-        }
-        for (SubsetTableIndex i = 0; i < table.size(); ++i) {
-            SubsetTableEntry& entry = table[i];
-            for (size_t j = 0; j < entry.trans.size(); ++j) {
-                SubsetTableIndex index = entry.trans[j];
-                if (index == noTransition) {
-                    continue;
-                }
-                nodes[i]->trans.push_back(Transition{ alphabet[j], nodes[index] });
+            all.push_back(p);
+            for (auto it = p->trans.rbegin(); it != p->trans.rend(); ++it) {
+                stack.push_back(it->second);
             }
         }
-        nfa = NFA{ Constants::notCharacter };
-        dfa.first = nodes[0];
-        dfa.sz = table.size();
-        return nodes;
+        return all;
     }
 
-    // Hopcrofts Algorithm
-    // CHAPTER 2 Scanners, 2.4 FROM REGULAR EXPRESSION TO SCANNER, 2.4.4 DFA to Minimal DFA: Hopcrofts Algorithm
-    // FIGURE 2.9 DFA Minimization Algorithm
-    void Regexp::MinimizeDFA(const std::vector<DFAnode*> nodes)
+    DFAnode* DFA::CreateDFANode(const bool accept, const Index label)
     {
-        constexpr size_t qty = 2;                               // initial quantity of SP
-        constexpr Index indexA = 0;                             // index of the std::vector<DFAnode*> with accepting states
-        constexpr Index indexNA = 1;                            // index of the std::vector<DFAnode*> with nonaccepting states
-        Index index{ indexNA };                                 // index of the last std::vector<DFAnode*>
-        std::unordered_map<const DFAnode*, Index> indexes;      // indexes of std::vector<DFAnode*>
-        SetPartition sp;                                        // set partition
-        SetPartition temp;                                      // set partition
-        sp.reserve(nodes.size());
-        temp.reserve(nodes.size());
-        temp.resize(qty);
-        for (DFAnode* ptr : nodes) {
-            if (ptr->acc == true) {
-                indexes.emplace(ptr, indexA);
-                temp[indexA].push_back(ptr);
-            }
-            else {
-                indexes.emplace(ptr, indexNA);
-                temp[indexNA].push_back(ptr);
-            }
-        }
-        while (sp.size() != temp.size()) {
-            sp = temp;
-            temp.clear();
-            temp.resize(sp.size());
-            for (Index i = 0; i < sp.size(); ++i) {
-                const std::vector<DFAnode*>& set = sp[i];
-                if (set.size() == 1) {
-                    temp[i] = set;
-                    continue;
-                }
-                std::pair<std::vector<DFAnode*>, std::vector<DFAnode*>> pair = Split(set, indexes);
-                temp[i] = pair.first;
-                if (pair.second.size() != 0) {
-                    AssignNumber(pair.second, ++index, indexes);
-                    temp.push_back(pair.second);
-                }
-            }
+        return arena.Create(accept, label);
+    }
+
+    bool operator==(const DFA& left, const DFA& right)
+    {
+        if (left.sz != right.sz) {
+            return false;
+        }
+        if (left.first == nullptr && right.first == nullptr) {
+            return true;
         }
-        if (nodes.size() != sp.size()) {
-            dfa = CreateMinimalDFA(sp, indexes);
+        std::set<const DFAnode*> visited;
+        if (left.first == nullptr || right.first == nullptr || !Equal(left.first, right.first, visited)) {
+            return false;
         }
+        return true;
     }
 
-    void Regexp::SetFlags()
+    bool Equal(const DFAnode* left, const DFAnode* right, std::set<const DFAnode*>& visited)
     {
-        for (const Character ch : alphabet) {
-            if (FLAG_IS_SET(ch, CHARFL_NEGATED)) {
-                fl = FLAGS_SET(fl, REGFL_NEGATED);
-                break;
+        visited.emplace(left);
+        if (left->acc != right->acc) {
+            return false;
+        }
+        if (left->trans.size() != right->trans.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < left->trans.size(); ++i) {
+            if (left->trans[i].first != right->trans[i].first) {
+                return false;
+            }
+            if (visited.find(left->trans[i].second) == visited.end()) {
+                if (!Equal(left->trans[i].second, right->trans[i].second, visited)) {
+                    return false;
+                }
             }
         }
+        return true;
     }
 
-    // parse Goal
-    NFA Regexp::PGoal()
+    DFA::DFA(DFA&& other)
+        : arena{ std::move(other.arena) }
     {
-        NextToken();
-        return PAlternation();
+        first = other.first;
+        sz = other.sz;
+        other.first = nullptr;
+        other.sz = 0;
     }
 
-    // parse Alternation
-    NFA Regexp::PAlternation()
+    DFA& DFA::operator=(DFA&& other)
     {
-        NFA a = PConcatenation();
-        PAlternationPrime(a);
-        return a;
+        if (this == &other) {
+            return *this;
+        }
+        arena = std::move(other.arena);
+        first = other.first;
+        sz = other.sz;
+        other.first = nullptr;
+        other.sz = 0;
+        return *this;
     }
 
-    // parse Alternation'
-    void Regexp::PAlternationPrime(NFA& a)
+    ///----------------------------------------------------------------------------------------------------
+
+    CharacterClassMap::CharacterClassMap()
+        : beyond{ 0 } {}
+
+    // 'ranges' must be sorted and must not overlap, characters that are not in 'ranges' belong to class 0
+    CharacterClassMap::CharacterClassMap(const std::vector<ClassRange>& ranges)
+        : CharacterClassMap()
     {
-        switch (token.second) {
-        case Regexp::TokenStream::TokenType::EOS:
-            return;
-        case Regexp::TokenStream::TokenType::SPECIAL:
-            switch (token.first) {
-            case SPEC_RPAR:
-                return;
-            case SPEC_BAR:
-                NextToken();
-                a.Alternate(PConcatenation());
-                PAlternationPrime(a);
-                return;
-            default:
-                break;
+        std::unordered_map<ClassIndex, unsigned int> uniform;   // blocks filled with a single class
+        for (const ClassRange& r : ranges) {
+            const ClassIndex cl = r.second;
+            if (r.first.second > ALLSUPPLEMENTARYPLANES_MAX) {
+                beyond = cl;
+            }
+            if (cl == 0 || r.first.first > ALLSUPPLEMENTARYPLANES_MAX) {
+                continue;
+            }
+            const Character last = std::min(r.first.second, static_cast<Character>(ALLSUPPLEMENTARYPLANES_MAX));
+            if ((last >> Constants::classBlockBits) >= directory.size()) {
+                if (blocks.size() == 0) {
+                    blocks.resize(Constants::classBlockSize, 0);
+                }
+                directory.resize((last >> Constants::classBlockBits) + 1, 0);
+            }
+            Character ch = r.first.first;
+            while (true) {
+                const Index dir = ch >> Constants::classBlockBits;
+                const Character stop = std::min(last, ch | Constants::classBlockMask);
+                if ((ch & Constants::classBlockMask) == 0 && stop - ch == Constants::classBlockMask) {
+                    auto it = uniform.find(cl);
+                    if (it == uniform.end()) {
+                        it = uniform.emplace(cl, static_cast<unsigned int>(blocks.size())).first;
+                        blocks.resize(blocks.size() + Constants::classBlockSize, cl);
+                    }
+                    directory[dir] = it->second;
+                }
+                else {
+                    if (directory[dir] == 0) {
+                        directory[dir] = static_cast<unsigned int>(blocks.size());
+                        blocks.resize(blocks.size() + Constants::classBlockSize, 0);
+                    }
+                    std::fill(blocks.begin() + directory[dir] + (ch & Constants::classBlockMask),
+                        blocks.begin() + directory[dir] + (stop & Constants::classBlockMask) + 1, cl);
+                }
+                if (stop == last) {
+                    break;
+                }
+                ch = stop + 1;
             }
-        case Regexp::TokenStream::TokenType::LITERAL:
-            break;
-        default:
-            break;
         }
-        ThrowInvalidRegexCharacter(ts.GetPosition());
     }
 
-    // parse Concatenation
-    NFA Regexp::PConcatenation()
+    bool operator==(const CharacterClassMap& left, const CharacterClassMap& right)
     {
-        NFA a = PTerm();
-        PConcatenationPrime(a);
-        return a;
+        return (left.directory == right.directory && left.blocks == right.blocks && left.beyond == right.beyond);
     }
 
-    // parse Concatenation'
-    void Regexp::PConcatenationPrime(NFA& a)
+    constexpr StateIndex DenseDFA::dead;
+
+    size_t DenseDFA::MemoryUsage() const
     {
-        switch (token.second) {
-        case Regexp::TokenStream::TokenType::EOS:
-            return;
-        case Regexp::TokenStream::TokenType::SPECIAL:
-            switch (token.first) {
-            case SPEC_LPAR:
-            case SPEC_LBRACKET:
-            case SPEC_BSLASH:
-                a.Concatenate(PTerm());
-                PConcatenationPrime(a);
-                return;
-            case SPEC_RPAR:
-            case SPEC_BAR:
-                return;
-            default:
-                break;
+        return classes.MemoryUsage() + ranges.capacity() * sizeof(ClassRange) + trans.capacity() * sizeof(StateIndex)
+            + labels.capacity() * sizeof(Index);
+    }
+
+    bool operator==(const DenseDFA& left, const DenseDFA& right)
+    {
+        return (left.classes == right.classes && left.trans == right.trans && left.nStates == right.nStates
+            && left.nClasses == right.nClasses && left.start == right.start && left.firstAccept == right.firstAccept
+            && left.labels == right.labels);
+    }
+
+    ///----------------------------------------------------------------------------------------------------
+
+    constexpr size_t CharacterRangeSet::maxRanges;
+
+    // 'ranges' may overlap, if there are more than 'maxRanges' of them, the ranges separated by the smallest gaps
+    // are joined, so the set may contain more characters than 'ranges'
+    CharacterRangeSet::CharacterRangeSet(std::vector<CharacterRange> ranges)
+    {
+        std::sort(ranges.begin(), ranges.end());
+        for (const CharacterRange& r : ranges) {
+            if (this->ranges.size() > 0 && r.first <= this->ranges.back().second + 1) {
+                this->ranges.back().second = std::max(this->ranges.back().second, r.second);
+            }
+            else {
+                this->ranges.push_back(r);
             }
-        case Regexp::TokenStream::TokenType::LITERAL:
-            a.Concatenate(PTerm());
-            PConcatenationPrime(a);
-            return;
-        default:
-            break;
         }
-        ThrowInvalidRegexCharacter(ts.GetPosition());
+        while (this->ranges.size() > maxRanges) {
+            size_t k = 1;
+            for (size_t i = 2; i < this->ranges.size(); ++i) {
+                if (this->ranges[i].first - this->ranges[i - 1].second
+                    < this->ranges[k].first - this->ranges[k - 1].second) {
+                    k = i;
+                }
+            }
+            this->ranges[k - 1].second = this->ranges[k].second;
+            this->ranges.erase(this->ranges.begin() + k);
+        }
     }
 
-    // parse Term
-    NFA Regexp::PTerm()
+    bool CharacterRangeSet::Contains(const Character ch) const
     {
-        NFA a = PBlock();
-        PClosure(a);
-        return a;
+        for (const CharacterRange& r : ranges) {
+            if (r.first <= ch && ch <= r.second) {
+                return true;
+            }
+        }
+        return false;
     }
 
-    // parse Block
-    NFA Regexp::PBlock()
+#if REGEX_USE_SSE2
+    namespace
     {
-        switch (token.second) {
-        case Regexp::TokenStream::TokenType::SPECIAL:
-            switch (token.first) {
-            case SPEC_LPAR: {
-                NextToken();
-                NFA a = PAlternation();
-                if (token.first == SPEC_RPAR) {
-                    NextToken();
-                    return a;
+        // lanes of the result are all ones for the characters in the set: 'ch' is in [first, last]
+        // if 'ch - first' is less than 'last - first + 1' as unsigned, SSE2 only compares signed integers,
+        // so both sides are biased by 0x80000000
+        class RangeMask {
+            __m128i first[CharacterRangeSet::maxRanges];
+            __m128i size[CharacterRangeSet::maxRanges];
+            size_t n;
+        public:
+            RangeMask(const std::vector<CharacterRange>& ranges)
+                : n{ ranges.size() }
+            {
+                for (size_t i = 0; i < n; ++i) {
+                    first[i] = _mm_set1_epi32(static_cast<int>(ranges[i].first));
+                    size[i] = _mm_set1_epi32(static_cast<int>((ranges[i].second - ranges[i].first + 1) ^ 0x80000000u));
                 }
-                break;
             }
-            case SPEC_LBRACKET: {
-                NextToken();
-                NFA a = PCharacterClass();
-                if (token.first == SPEC_RBRACKET) {
-                    NextToken();
-                    return a;
+
+            __m128i operator()(const __m128i chars) const
+            {
+                const __m128i bias = _mm_set1_epi32(static_cast<int>(0x80000000u));
+                __m128i mask = _mm_setzero_si128();
+                for (size_t i = 0; i < n; ++i) {
+                    const __m128i offset = _mm_xor_si128(_mm_sub_epi32(chars, first[i]), bias);
+                    mask = _mm_or_si128(mask, _mm_cmpgt_epi32(size[i], offset));
                 }
-                break;
+                return mask;
             }
-            default:
-                return PAtom();
+        };
+
+        // the same as RangeMask for 16 bytes, the ranges are cut at 0xFF
+        class ByteRangeMask {
+            __m128i first[CharacterRangeSet::maxRanges];
+            __m128i size[CharacterRangeSet::maxRanges];
+            size_t n;
+        public:
+            ByteRangeMask(const std::vector<CharacterRange>& ranges)
+                : n{ 0 }
+            {
+                for (const CharacterRange& range : ranges) {
+                    if (range.first <= 0xFF) {
+                        first[n] = _mm_set1_epi8(static_cast<char>(range.first));
+                        size[n] = _mm_set1_epi8(static_cast<char>(std::min<Character>(range.second, 0xFF) - range.first));
+                        ++n;
+                    }
+                }
             }
-            break;
-        default:
-            return PAtom();
-        }
-        ThrowInvalidRegexCharacter(ts.GetPosition());
+
+            __m128i operator()(const __m128i bytes) const
+            {
+                const __m128i zero = _mm_setzero_si128();
+                __m128i mask = zero;
+                for (size_t i = 0; i < n; ++i) {
+                    const __m128i offset = _mm_sub_epi8(bytes, first[i]);
+                    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(_mm_subs_epu8(offset, size[i]), zero));
+                }
+                return mask;
+            }
+        };
     }
+#endif // REGEX_USE_SSE2
 
-    // parse CharacterClass
-    NFA Regexp::PCharacterClass()
+    // the function returns the first character of [first, last) that is in the set or nullptr
+    const char32_t* CharacterRangeSet::FindFirst(const char32_t* first, const char32_t* last) const
     {
-        const CharacterFlags flag = PNegation() ? CHARFL_NEGATED : CHARFL_NOFLAGS;
-        return PCharacterClassRange(flag, Constants::AtomType::CHARCLASS);
+#if REGEX_USE_SSE2
+        const RangeMask inSet{ ranges };
+        while (last - first >= 4) {
+            const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+            const int bits = _mm_movemask_ps(_mm_castsi128_ps(inSet(chars)));
+            if (bits != 0) {
+                return first + ((bits & 1) ? 0 : (bits & 2) ? 1 : (bits & 4) ? 2 : 3);
+            }
+            first += 4;
+        }
+#endif // REGEX_USE_SSE2
+        for (; first != last; ++first) {
+            if (Contains(*first)) {
+                return first;
+            }
+        }
+        return nullptr;
     }
 
-    // parse Negation
-    bool Regexp::PNegation()
+    // the function returns the last character of [first, last) that is in the set or nullptr
+    const char32_t* CharacterRangeSet::FindLast(const char32_t* first, const char32_t* last) const
     {
-        if (token.first == LIT_CARET) {
-            NextToken();
-            return true;
+#if REGEX_USE_SSE2
+        const RangeMask inSet{ ranges };
+        while (last - first >= 4) {
+            const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(last - 4));
+            const int bits = _mm_movemask_ps(_mm_castsi128_ps(inSet(chars)));
+            if (bits != 0) {
+                return last - 4 + ((bits & 8) ? 3 : (bits & 4) ? 2 : (bits & 2) ? 1 : 0);
+            }
+            last -= 4;
         }
-        return false;
+#endif // REGEX_USE_SSE2
+        while (last != first) {
+            --last;
+            if (Contains(*last)) {
+                return last;
+            }
+        }
+        return nullptr;
     }
 
-    // parse CharacterClassRange
-    NFA Regexp::PCharacterClassRange(const CharacterFlags flags, const Constants::AtomType type)
+    // the function returns the last byte of [first, last) that is in the set or nullptr
+    const unsigned char* CharacterRangeSet::FindLast(const unsigned char* first, const unsigned char* last) const
     {
-        NFA a = PAtom(flags, type);
-        PCharacterClassRangePrime(flags, type, a);
-        return a;
+#if REGEX_USE_SSE2
+        const ByteRangeMask inSet{ ranges };
+        while (last - first >= 16) {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(last - 16));
+            const int bits = _mm_movemask_epi8(inSet(bytes));
+            if (bits != 0) {
+                int k = 15;
+                while ((bits & (1 << k)) == 0) {
+                    --k;
+                }
+                return last - 16 + k;
+            }
+            last -= 16;
+        }
+#endif // REGEX_USE_SSE2
+        while (last != first) {
+            --last;
+            if (Contains(*last)) {
+                return last;
+            }
+        }
+        return nullptr;
     }
 
-    // parse CharacterClassRange'
-    void Regexp::PCharacterClassRangePrime(const CharacterFlags flags, const Constants::AtomType type, NFA& a)
+    // the function returns the number of the characters of [first, last) that are in the set
+    size_t CharacterRangeSet::Count(const char32_t* first, const char32_t* last) const
     {
-        switch (token.second) {
-        case Regexp::TokenStream::TokenType::EOS:
-            return;
-        case Regexp::TokenStream::TokenType::SPECIAL:
-            switch (token.first) {
-            case SPEC_RBRACKET:
-                return;
-            default:
-                a.Alternate(PAtom(flags, type));
-                PCharacterClassRangePrime(flags, type, a);
-                return;
+        size_t count = 0;
+#if REGEX_USE_SSE2
+        const RangeMask inSet{ ranges };
+        while (last - first >= 4) {
+            // the lanes of 'sum' count up to 'maxSteps', so they cannot overflow
+            constexpr ptrdiff_t maxSteps = 1 << 24;
+            const ptrdiff_t steps = std::min((last - first) / 4, maxSteps);
+            __m128i sum = _mm_setzero_si128();
+            for (ptrdiff_t i = 0; i < steps; ++i, first += 4) {
+                const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+                sum = _mm_sub_epi32(sum, inSet(chars));
             }
-            break;
-        case Regexp::TokenStream::TokenType::LITERAL:
-            if (token.first == LIT_HYPHEN) {
-                const Character firstChar = last;
-                NextToken();
-                NFA b = PAtom(flags, type);
-                const Character lastChar = last;
-                CheckRange(firstChar, lastChar);
-                Character ch = firstChar;
-                while (++ch < lastChar) {
-                    AddToAlphabet(ch);
-                    a.Alternate(NFA{ ch });
-                }
-                a.Alternate(b);
-                PCharacterClassRangePrime(flags, type, a);
-                return;
+            unsigned int lanes[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+            count += size_t{ lanes[0] } + lanes[1] + lanes[2] + lanes[3];
+        }
+#endif // REGEX_USE_SSE2
+        for (; first != last; ++first) {
+            if (Contains(*first)) {
+                ++count;
             }
-            a.Alternate(PAtom(flags, type));
-            PCharacterClassRangePrime(flags, type, a);
-            return;
-        default:
-            break;
         }
-        ThrowInvalidRegexCharacter(ts.GetPosition());
+        return count;
     }
 
-    void RE::Regexp::CheckRange(Character first, Character last)
+    ///----------------------------------------------------------------------------------------------------
+
+    // the values follow the order of the characters by frequency in English text and source code,
+    // the control characters other than TAB, LF and CR are the rarest
+    unsigned char CharacterFrequency(const Character ch)
     {
-        constexpr size_t qty = 3;
-        first = FLAGS_UNSET(first, CHARFL_ALLFLAGS);
-        last = FLAGS_UNSET(last, CHARFL_ALLFLAGS);
-        if (first >= last) {
-            ThrowInvalidRegexRange(ts.GetPosition(), ts.GetSubstring(qty));
-        }
+        static const unsigned char ascii[ASCII_CTRL_DEL + 1] = {
+              0,   0,   0,   0,   0,   0,   0,   0,   0, 131, 225,   0,   0, 197,   0,   0,   // 0x00-0x0F
+              0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   // 0x10-0x1F
+            255,  81, 195,  91,  89,  87,  85, 127, 187, 185, 101,  77, 211, 199, 209, 183,   // 0x20-0x2F
+            203, 201, 193, 169, 159, 161, 153, 151, 155, 157, 167, 129, 105, 189, 103,  79,   // 0x30-0x3F
+             83, 177, 137, 173, 145, 171, 133, 119, 135, 175, 107, 113, 141, 163, 143, 139,   // 0x40-0x4F
+            149,  73, 147, 179, 181, 115, 111, 117,  75, 109,  71,  99,  69,  97,  65, 191,   // 0x50-0x5F
+             61, 249, 213, 231, 233, 253, 223, 219, 237, 245, 125, 205, 235, 227, 243, 247,   // 0x60-0x6F
+            221, 123, 239, 241, 251, 229, 207, 217, 165, 215, 121,  95,  67,  93,  63,   0   // 0x70-0x7F
+        };
+        constexpr unsigned char nonASCII = 40;
+        return (ch <= ASCII_CTRL_DEL) ? ascii[ch] : nonASCII;
     }
 
-    // parse Atom
-    NFA RE::Regexp::PAtom(const CharacterFlags flags, const Constants::AtomType type)
+    Prefilter::Prefilter(const std::u32string& literal)
+        : literal{ literal }, rare{ 0 }
     {
-        switch (token.second) {
-        case Regexp::TokenStream::TokenType::EOS:
-            break;
-        case Regexp::TokenStream::TokenType::SPECIAL:
-            switch (token.first) {
-            case SPEC_DOT:
-                if (type == Constants::AtomType::CHARCLASS) {
-                    last = FLAGS_SET(token.first, flags);
-                    NextToken();
-                    AddToAlphabet(last);
-                    return NFA{ last };
-                }
-                else if (type == Constants::AtomType::STANDART) {
-                    NextToken();
-                    return PNotNewline();
-                }
-                break;
-            case SPEC_BSLASH:
-                NextToken(false);
-                return PEscape(flags, type);
-            case SPEC_LBRACKET:
-            case SPEC_RBRACKET:
-                break;
-            default:
-                if (type == Constants::AtomType::CHARCLASS) {
-                    last = FLAGS_SET(token.first, flags);
-                    NextToken();
-                    AddToAlphabet(last);
-                    return NFA{ last };
-                }
-                break;
+        for (size_t i = 1; i < literal.size(); ++i) {
+            if (CharacterFrequency(literal[i]) < CharacterFrequency(literal[rare])) {
+                rare = i;
             }
-            break;
-        case Regexp::TokenStream::TokenType::LITERAL: {
-            last = FLAGS_SET(token.first, flags);
-            NextToken();
-            AddToAlphabet(last);
-            return NFA{ last };
         }
-        default:
-            break;
+        if (literal.size() > 0) {
+            scan = CharacterRangeSet{ { CharacterRange{ literal[rare], literal[rare] } } };
         }
-        ThrowInvalidRegexCharacter(ts.GetPosition());
+        bytes = EncodeUtf8(literal);
+        rareByte = EncodeUtf8(literal.substr(0, rare)).size();
     }
 
-    // parse '.' (dot)
-    NFA RE::Regexp::PNotNewline()
+    // the function returns the first occurrence of the literal in [first, last) or nullptr
+    const char32_t* Prefilter::Find(const char32_t* first, const char32_t* last) const
     {
-        RE::Character lf = FLAGS_SET(CTRL_LF, CHARFL_NEGATED);
-        RE::Character cr = FLAGS_SET(CTRL_CR, CHARFL_NEGATED);
-        RE::Character ls = FLAGS_SET(CTRL_LS, CHARFL_NEGATED);
-        RE::Character ps = FLAGS_SET(CTRL_PS, CHARFL_NEGATED);
-        AddToAlphabet(lf);
-        AddToAlphabet(cr);
-        AddToAlphabet(ls);
-        AddToAlphabet(ps);
-        NFA a{ lf };
-        a.Alternate(NFA{ cr });
-        a.Alternate(NFA{ ls });
-        a.Alternate(NFA{ ps });
-        return a;
+        if (static_cast<size_t>(last - first) < literal.size()) {
+            return nullptr;
+        }
+        const char32_t* candidate = first + rare;
+        const char32_t* stop = last - (literal.size() - rare) + 1;
+        while ((candidate = scan.FindFirst(candidate, stop)) != nullptr) {
+            if (std::equal(literal.begin(), literal.end(), candidate - rare)) {
+                return candidate - rare;
+            }
+            ++candidate;
+        }
+        return nullptr;
     }
 
-    // parse Escape
-    NFA RE::Regexp::PEscape(const CharacterFlags flags, const Constants::AtomType type)
+    // the same as above for the UTF-8 text
+    const unsigned char* Prefilter::Find(const unsigned char* first, const unsigned char* last) const
     {
-        switch (token.second) {
-        case Regexp::TokenStream::TokenType::EOS:
-            break;
-        case Regexp::TokenStream::TokenType::SPECIAL: {
-            last = FLAGS_SET(token.first, flags);
-            NextToken();
-            AddToAlphabet(last);
-            return NFA{ last };
+        if (static_cast<size_t>(last - first) < bytes.size()) {
+            return nullptr;
         }
-        case Regexp::TokenStream::TokenType::LITERAL: {
-            last = Constants::notCharacter;
-            if (!PIsEscape(last, type)) {
-                last = token.first;
+        const unsigned char* candidate = first + rareByte;
+        const unsigned char* stop = last - (bytes.size() - rareByte) + 1;
+        while (candidate < stop
+            && (candidate = static_cast<const unsigned char*>(std::memchr(candidate, bytes[rareByte], stop - candidate))) != nullptr)
+        {
+            if (std::memcmp(bytes.data(), candidate - rareByte, bytes.size()) == 0) {
+                return candidate - rareByte;
             }
-            last = FLAGS_SET(last, flags);
-            NextToken();
-            AddToAlphabet(last);
-            return NFA{ last };
+            ++candidate;
         }
-        default:
-            break;
+        return nullptr;
+    }
+
+    LiteralSearcher::LiteralSearcher(const std::u32string& literal)
+        : literal{ literal }, shift(256, literal.size())
+    {
+        for (size_t i = 0; i + 1 < literal.size(); ++i) {
+            shift[literal[i] & 0xFF] = literal.size() - 1 - i;
         }
-        ThrowInvalidRegexCharacter(ts.GetPosition());
     }
 
-    // parse ESCAPE
-    bool RE::Regexp::PIsEscape(Character& ch, const Constants::AtomType type)
+    // the function returns the first occurrence of the literal in [first, last) or nullptr
+    const char32_t* LiteralSearcher::Find(const char32_t* first, const char32_t* last) const
     {
-        switch (token.first) {
-        case ESC_0:
-            ch = CTRL_NULL;
-            return true;
-        case ESC_b:
-            if (type == Constants::AtomType::CHARCLASS) {
-                ch = CTRL_BS;
-                return true;
+        const size_t m = literal.size();
+        const Character back = literal[m - 1];
+        while (static_cast<size_t>(last - first) >= m) {
+            const Character ch = first[m - 1];
+            if (ch == back && std::equal(literal.begin(), literal.end() - 1, first)) {
+                return first;
             }
-            return false;
-        case ESC_t:
-            ch = CTRL_TAB;
-            return true;
-        case ESC_n:
-            ch = CTRL_LF;
-            return true;
-        case ESC_v:
-            ch = CTRL_VT;
-            return true;
-        case ESC_f:
-            ch = CTRL_FF;
-            return true;
-        case ESC_r:
-            ch = CTRL_CR;
-            return true;
-        case ESC_c:
-            NextToken(false);
-            ch = PGetControlCode();
-            return true;
-        case ESC_x:
-            NextToken(false);
-            ch = PGetASCIICharacter();
-            return true;
-        case ESC_u: {
-            NextToken(false);
-            ch = PGetUnicodeCharacter(Constants::unicodeDigits_4);
-            return true;
+            first += shift[ch & 0xFF];
         }
-        case ESC_U: {
-            NextToken(false);
-            ch = PGetUnicodeCharacter(Constants::unicodeDigits_6);
-            return true;
+        return nullptr;
+    }
+
+    constexpr StateIndex AhoCorasick::root;
+    constexpr StateIndex AhoCorasick::none;
+    constexpr size_t AhoCorasick::maxDenseSize;
+
+    // the trie is built from the sorted strings, so the edges of each state are created in the order
+    // of their classes, the failure links and the transitions are found in breadth-first order
+    AhoCorasick::AhoCorasick(std::vector<std::u32string> strings)
+    {
+        std::sort(strings.begin(), strings.end());
+        std::vector<Character> chars;
+        std::vector<CharacterRange> first;
+        for (const std::u32string& string : strings) {
+            chars.insert(chars.end(), string.begin(), string.end());
+            if (string.size() > 0) {
+                first.push_back(CharacterRange{ string[0], string[0] });
+            }
         }
-        default:
-            return false;
+        std::sort(chars.begin(), chars.end());
+        chars.erase(std::unique(chars.begin(), chars.end()), chars.end());
+        std::vector<ClassRange> ranges;
+        for (size_t i = 0; i < chars.size(); ++i) {
+            ranges.push_back(ClassRange{ CharacterRange{ chars[i], chars[i] }, static_cast<ClassIndex>(i + 1) });
+        }
+        classes = CharacterClassMap{ ranges };
+        nClasses = chars.size() + 1;
+        firstChars = CharacterRangeSet{ first };
+
+        std::vector<std::vector<Edge>> children(1);
+        depth.push_back(0);
+        out.push_back(0);
+        std::vector<StateIndex> path{ root };   // states of the prefix of the previous string
+        const std::u32string* previous = nullptr;
+        for (const std::u32string& string : strings) {
+            size_t common = 0;                  // length of the prefix shared with the previous string
+            if (previous != nullptr) {
+                while (common < previous->size() && common < string.size() && (*previous)[common] == string[common]) {
+                    ++common;
+                }
+            }
+            path.resize(common + 1);
+            for (size_t i = common; i < string.size(); ++i) {
+                const StateIndex state = static_cast<StateIndex>(depth.size());
+                children[path.back()].push_back(Edge{ classes[string[i]], state });
+                children.emplace_back();
+                depth.push_back(static_cast<StateIndex>(i + 1));
+                out.push_back(0);
+                path.push_back(state);
+            }
+            out[path.back()] = static_cast<StateIndex>(string.size());
+            previous = &string;
+        }
+        edgesFirst.reserve(children.size() + 1);
+        for (const std::vector<Edge>& c : children) {
+            edgesFirst.push_back(static_cast<StateIndex>(edges.size()));
+            edges.insert(edges.end(), c.begin(), c.end());
+        }
+        edgesFirst.push_back(static_cast<StateIndex>(edges.size()));
+
+        // the row of a state is the row of its failure state with the trie edges of the state
+        const bool dense = depth.size() * nClasses <= maxDenseSize;
+        if (dense) {
+            trans.resize(depth.size() * nClasses, root);
+        }
+        fail.resize(depth.size(), root);
+        std::vector<StateIndex> queue{ root };
+        for (size_t i = 0; i < queue.size(); ++i) {
+            const StateIndex s = queue[i];
+            if (dense && s != root) {
+                std::copy_n(trans.begin() + fail[s] * nClasses, nClasses, trans.begin() + s * nClasses);
+            }
+            for (StateIndex e = edgesFirst[s]; e < edgesFirst[s + 1]; ++e) {
+                const StateIndex t = edges[e].second;
+                if (s != root) {
+                    fail[t] = Next(fail[s], edges[e].first);
+                }
+                if (out[t] == 0) {
+                    out[t] = out[fail[t]];
+                }
+                if (dense) {
+                    trans[s * nClasses + edges[e].first] = t;
+                }
+                queue.push_back(t);
+            }
         }
     }
 
-    // parse ESCAPE '\c'
-    Character RE::Regexp::PGetControlCode()
+    // the function returns the trie edge of 'state' on 'cl' or 'none'
+    StateIndex AhoCorasick::Goto(const StateIndex state, const ClassIndex cl) const
     {
-        constexpr size_t qty = 1;
-        const Character ch{ token.first };
-        if (ch >= 'a' && ch <= 'z') {
-            return static_cast<Character>(static_cast<unsigned int>(ch) - ('a' - 1));
+        const auto first = edges.begin() + edgesFirst[state];
+        const auto last = edges.begin() + edgesFirst[state + 1];
+        const auto it = std::lower_bound(first, last, cl,
+            [](const Edge& e, const ClassIndex cl) { return e.first < cl; });
+        return (it != last && it->first == cl) ? it->second : none;
+    }
+
+    StateIndex AhoCorasick::Next(StateIndex state, const ClassIndex cl) const
+    {
+        if (trans.size() != 0) {
+            return trans[state * nClasses + cl];
         }
-        else if (ch >= 'A' && ch <= 'Z') {
-            return static_cast<Character>(static_cast<unsigned int>(ch) - ('A' - 1));
+        while (true) {
+            const StateIndex next = Goto(state, cl);
+            if (next != none) {
+                return next;
+            }
+            if (state == root) {
+                return root;
+            }
+            state = fail[state];
         }
-        NextToken();
-        ThrowInvalidRegexEscape(ts.GetPosition(), ts.GetSubstring(qty));
     }
 
-    // parse ESCAPE '\x'
-    Character RE::Regexp::PGetASCIICharacter()
+    // the function returns true if [first, last) is one of the strings
+    bool AhoCorasick::Match(const char32_t* first, const char32_t* last) const
     {
-        constexpr size_t qty = 1;
-        const Character ch1{ token.first };
-        NextToken(false);
-        const Character ch2{ token.first };
-        if (isxdigit(ch1) && isxdigit(ch2)) {
-            std::istringstream iss{ std::string{ static_cast<char>(ch1) } + static_cast<char>(ch2) };
-            unsigned int value{ 0 };
-            iss >> std::hex >> value;
-            if (iss && value >= 0x00 && value <= 0x7F) {
-                return static_cast<Character>(value);
+        StateIndex state = root;
+        for (; first != last; ++first) {
+            state = Goto(state, classes[*first]);
+            if (state == none) {
+                return false;
             }
         }
-        NextToken();
-        ThrowInvalidRegexEscape(ts.GetPosition(), ts.GetSubstring(qty));
+        return state != root && out[state] == depth[state];
     }
 
-    // parse ESCAPE '\u' and '\U'
-    Character RE::Regexp::PGetUnicodeCharacter(const int nDigits)
+    // the function returns the leftmost-longest occurrence of the strings in [first, last) or { nullptr, nullptr },
+    // after an occurrence is found the text is read while a string that begins not after it may be in progress:
+    // the strings in progress are suffixes of the state, so they begin not before 'p + 1 - depth[state]'
+    std::pair<const char32_t*, const char32_t*> AhoCorasick::Find(const char32_t* first, const char32_t* last) const
     {
-        constexpr size_t qty = 1;
-        std::string s;
-        bool valid{ true };
-        for (size_t i = 0; i < nDigits; ++i) {
-            if (isxdigit(token.first)) {
-                s += static_cast<char>(token.first);
+        std::pair<const char32_t*, const char32_t*> best{ nullptr, nullptr };
+        StateIndex state = root;
+        for (const char32_t* p = first; p != last; ++p) {
+            if (state == root) {
+                if (best.first != nullptr) {
+                    break;
+                }
+                // only the first characters of the strings leave the root
+                p = firstChars.FindFirst(p, last);
+                if (p == nullptr) {
+                    break;
+                }
             }
-            else {
-                valid = false;
+            state = Next(state, classes[*p]);
+            if (best.first != nullptr && p + 1 - depth[state] > best.first) {
+                break;
             }
-            if (i < nDigits - 1) {
-                NextToken(false);
+            if (out[state] != 0) {
+                const char32_t* begin = p + 1 - out[state];
+                if (best.first == nullptr || begin < best.first || (begin == best.first && p + 1 > best.second)) {
+                    best = { begin, p + 1 };
+                }
             }
         }
-        if (valid) {
-            std::istringstream iss{ s };
-            unsigned long long int value{ 0 };
-            iss >> std::hex >> value;
-            if (iss) {
-                if (nDigits == Constants::unicodeDigits_4 && value >= BASICPLANE_MIN
-                    && value <= BASICPLANE_MAX) {
-                    return static_cast<Character>(value);
-                }
-                else if (nDigits == Constants::unicodeDigits_6 && value >= ALLSUPPLEMENTARYPLANES_MIN
-                    && value <= ALLSUPPLEMENTARYPLANES_MAX) {
-                    return static_cast<Character>(value);
+        return best;
+    }
+
+    // the function returns the end of the occurrence of the strings in [first, last) that ends first or nullptr
+    const char32_t* AhoCorasick::FindEnd(const char32_t* first, const char32_t* last) const
+    {
+        StateIndex state = root;
+        for (const char32_t* p = first; p != last; ++p) {
+            if (state == root) {
+                p = firstChars.FindFirst(p, last);
+                if (p == nullptr) {
+                    return nullptr;
                 }
             }
+            state = Next(state, classes[*p]);
+            if (out[state] != 0) {
+                return p + 1;
+            }
         }
-        NextToken();
-        ThrowInvalidRegexEscape(ts.GetPosition(), ts.GetSubstring(qty));
+        return nullptr;
     }
 
-    // parse Closure
+    size_t AhoCorasick::MemoryUsage() const
+    {
+        return classes.MemoryUsage() + edges.capacity() * sizeof(Edge)
+            + (edgesFirst.capacity() + fail.capacity() + trans.capacity() + depth.capacity() + out.capacity())
+            * sizeof(StateIndex);
+    }
+
+    ///----------------------------------------------------------------------------------------------------
+
+    // 'initial' is the initial block of each element, empty blocks are skipped
+    RefinablePartition::RefinablePartition(const std::vector<Index>& initial)
+        : elems(initial.size()), loc(initial.size()), set(initial.size()),
+        first(initial.size()), past(initial.size()), marked(initial.size(), 0), sz{ 0 }
+    {
+        if (initial.size() == 0) {
+            return;
+        }
+        std::vector<Index> count(*std::max_element(initial.begin(), initial.end()) + 1, 0);
+        for (const Index b : initial) {
+            ++count[b];
+        }
+        std::vector<Index> number(count.size());                // number of the nonempty block
+        Index begin{ 0 };
+        for (Index b = 0; b < count.size(); ++b) {
+            if (count[b] == 0) {
+                continue;
+            }
+            number[b] = sz;
+            first[sz] = past[sz] = begin;
+            begin += count[b];
+            ++sz;
+        }
+        for (Index e = 0; e < initial.size(); ++e) {
+            const Index b = number[initial[e]];
+            set[e] = b;
+            loc[e] = past[b]++;
+            elems[loc[e]] = e;
+        }
+    }
+
+    // marked elements of a block are moved to its beginning
+    void RefinablePartition::Mark(const Index element)
+    {
+        const Index s = set[element];
+        const Index i = loc[element];
+        const Index j = first[s] + marked[s];
+        if (i < j) {
+            return;
+        }
+        elems[i] = elems[j];
+        loc[elems[i]] = i;
+        elems[j] = element;
+        loc[element] = j;
+        if (marked[s]++ == 0) {
+            touched.push_back(s);
+        }
+    }
+
+    // every partly marked block is split, the smaller part becomes a new block
+    void RefinablePartition::Split()
+    {
+        while (touched.size() > 0) {
+            const Index s = touched.back();
+            touched.pop_back();
+            const Index j = first[s] + marked[s];
+            if (j == past[s]) {
+                marked[s] = 0;
+                continue;
+            }
+            if (marked[s] <= past[s] - j) {
+                first[sz] = first[s];
+                past[sz] = first[s] = j;
+            }
+            else {
+                past[sz] = past[s];
+                first[sz] = past[s] = j;
+            }
+            for (Index i = first[sz]; i < past[sz]; ++i) {
+                set[elems[i]] = sz;
+            }
+            marked[s] = marked[sz] = 0;
+            ++sz;
+        }
+    }
+
+    // Hopcroft's partition refinement for a DFA with partial transition function, O(m log n);
+    // every state must be able to reach an accepting state, which holds for a DFA obtained
+    // by the subset construction from a Thompson's NFA.
+    // The function returns the block of each state, equivalent states are in the same block.
+    std::vector<Index> PartitionStates(const std::vector<bool>& accept, const std::vector<NumberedTransition>& trans)
+    {
+        std::vector<Index> labels(accept.size());
+        for (Index q = 0; q < accept.size(); ++q) {
+            labels[q] = accept[q] ? 0 : 1;
+        }
+        return PartitionStates(labels, trans);
+    }
+
+    // the initial partition joins the states with the same label, so the states with different labels
+    // are never equivalent
+    std::vector<Index> PartitionStates(const std::vector<Index>& labels, const std::vector<NumberedTransition>& trans)
+    {
+        const size_t nStates = labels.size();
+        std::vector<Index> initial{ labels };
+        RefinablePartition blocks{ initial };
+        initial.resize(trans.size());
+        for (Index t = 0; t < trans.size(); ++t) {
+            initial[t] = trans[t].symbol;
+        }
+        RefinablePartition cords{ initial };                    // transitions grouped by symbol
+        std::vector<Index> inFirst(nStates + 1, 0);             // incoming transitions of state 'q' are
+        std::vector<Index> in(trans.size());                    // in[inFirst[q]], ..., in[inFirst[q + 1] - 1]
+        for (const NumberedTransition& t : trans) {
+            ++inFirst[t.to + 1];
+        }
+        for (Index q = 0; q < nStates; ++q) {
+            inFirst[q + 1] += inFirst[q];
+        }
+        {
+            std::vector<Index> next{ inFirst.begin(), inFirst.end() - 1 };
+            for (Index t = 0; t < trans.size(); ++t) {
+                in[next[trans[t].to]++] = t;
+            }
+        }
+        Index b{ 1 };                                           // next block used as splitter
+        Index c{ 0 };                                           // next cord used as splitter
+        while (c < cords.Size()) {
+            for (Index i = cords.GetFirst(c); i < cords.GetPast(c); ++i) {
+                blocks.Mark(trans[cords.GetElement(i)].from);
+            }
+            blocks.Split();
+            ++c;
+            while (b < blocks.Size()) {
+                for (Index i = blocks.GetFirst(b); i < blocks.GetPast(b); ++i) {
+                    const Index q = blocks.GetElement(i);
+                    for (Index j = inFirst[q]; j < inFirst[q + 1]; ++j) {
+                        cords.Mark(in[j]);
+                    }
+                }
+                cords.Split();
+                ++b;
+            }
+        }
+        std::vector<Index> result(nStates);
+        for (Index q = 0; q < nStates; ++q) {
+            result[q] = blocks.GetBlock(q);
+        }
+        return result;
+    }
+
+    ///----------------------------------------------------------------------------------------------------
+
+    // 1 substring == 1 sequence of tokens from which 1 atom is created
+    // qty == the quantity of last atoms for which the total substring will be obtained 
+    UString Regexp::TokenStream::GetSubstring(const size_t qty) const
+    {
+        UString s;
+        if (tss.size() == 0 || qty == 0) {
+            return s;
+        }
+        int i = tpos;
+        int counter = qty;
+        while (counter > 0) {
+            --counter;
+            i = (i <= 0) ? tss.size() - 1 : i - 1;
+        }
+        while (counter < qty) {
+            ++counter;
+            s += tss[i];
+            i = (i == tss.size() - 1) ? 0 : i + 1;
+        }
+        return s;
+    }
+
+    inline Regexp::TokenStream::TokenType Regexp::TokenStream::GetTokenType(const Character ch) const
+    {
+        switch (ch) {
+        case SPEC_LPAR:
+        case SPEC_RPAR:
+        case SPEC_STAR:
+        case SPEC_PLUS:
+        case SPEC_DOT:
+        case SPEC_QUESTION:
+        case SPEC_LBRACKET:
+        case SPEC_BSLASH:
+        case SPEC_RBRACKET:
+        case SPEC_LBRACE:
+        case SPEC_BAR:
+        case SPEC_RBRACE:
+            return TokenType::SPECIAL;
+        default:
+            return TokenType::LITERAL;
+        }
+    }
+
+    inline std::pair<Character, Regexp::TokenStream::TokenType> Regexp::TokenStream::GetToken() const
+    {
+        if (pos >= s.size()) {
+            return { Constants::notCharacter, TokenType::EOS };
+        }
+        const Character ch = s[pos];
+        return { ch, GetTokenType(ch) };
+    }
+
+    // the function adds the successors of the 'set' nodes on 'range' to 'reached',
+    // 'range' is an element of the alphabet, so it is either inside the range of the node or outside it
+    void Regexp::Delta(const IndexedNFA& inf, const StateSet& set, const CharacterRange& range,
+        SparseSet& reached) const
+    {
+        for (const Index i : set) {
+            if (inf.IsPosition(i)) {
+                const IndexedNFA::Counter& c = inf.counters[inf.CounterIndex(i)];
+                if (std::none_of(c.ranges.begin(), c.ranges.end(), [&range](const CharacterRange& r) {
+                    return r.first <= range.first && range.second <= r.second; })) {
+                    continue;
+                }
+                const Index v = i - c.first;
+                if (v + 1 < c.size) {
+                    reached.Insert(i + 1);
+                }
+                else if (c.loop) {
+                    reached.Insert(i);
+                }
+                if (v + 1 >= c.min) {
+                    reached.Insert(inf.succ1[c.node]);
+                }
+                continue;
+            }
+            const NFAnode* p = inf.nodes[i];
+            if (p->ty == NFAnode::Type::LITERAL && p->ch <= range.first && range.second <= p->chLast) {
+                reached.Insert(inf.succ1[i]);
+            }
+        }
+    }
+
+    // the function replaces 'reached' with the union of the precomputed Epsilon-closures of its members and
+    // returns the result in ascending order, 'reached' is cleared; a position of a counter is its own closure
+    StateSet Regexp::EpsilonClosure(const IndexedNFA& inf, SparseSet& reached) const
+    {
+        StateSet set;
+        for (const Index i : reached) {
+            if (inf.IsPosition(i)) {
+                set.push_back(i);
+                continue;
+            }
+            set.insert(set.end(), inf.ClosureBegin(i), inf.ClosureEnd(i));
+        }
+        reached.Clear();
+        std::sort(set.begin(), set.end());
+        set.erase(std::unique(set.begin(), set.end()), set.end());
+        return set;
+    }
+
+    const DFAnode* Regexp::FindTransition(const DFAnode* node, const Character ch) const
+    {
+        TransitionTable::const_iterator it =
+            std::lower_bound(node->trans.begin(), node->trans.end(), ch, LessTransitionCharacter{});
+        if (it == node->trans.end() || it->first.first > ch) {
+            return nullptr;
+        }
+        else {
+            return it->second;
+        }
+    }
+
+    // the function partitions the alphabet into equivalence classes (characters with identical columns
+    // of transitions) and stores the DFA as a dense 'state x class' table, state 0 is the dead state,
+    // the accept states follow the others
+    DenseDFA Regexp::CreateDenseDFA() const
+    {
+        std::vector<DFAnode*> nodes = dfa.GetAllNodes();
+        if (nodes.size() >= std::numeric_limits<StateIndex>::max()) {
+            throw Error::RuntimeError{ "CreateDenseDFA(): Too many DFA states" };
+        }
+        const std::vector<DFAnode*>::iterator firstAccept =
+            std::stable_partition(nodes.begin(), nodes.end(), [](const DFAnode* p) { return p->acc == false; });
+        std::unordered_map<const DFAnode*, StateIndex> indexes;
+        for (Index i = 0; i < nodes.size(); ++i) {
+            indexes.emplace(nodes[i], static_cast<StateIndex>(i + 1));
+        }
+        std::map<std::vector<StateIndex>, ClassIndex> columns;  // column of transitions -> class
+        columns.emplace(std::vector<StateIndex>(nodes.size() + 1, DenseDFA::dead), 0);
+        std::vector<ClassRange> ranges;
+        ranges.reserve(alphabet.size());
+        for (const CharacterRange& range : alphabet) {
+            std::vector<StateIndex> column(nodes.size() + 1, DenseDFA::dead);
+            for (Index i = 0; i < nodes.size(); ++i) {
+                const DFAnode* p = FindTransition(nodes[i], range.first);
+                if (TransitionExists(p)) {
+                    column[i + 1] = indexes.find(p)->second;
+                }
+            }
+            const ClassIndex cl = columns.emplace(std::move(column), columns.size()).first->second;
+            if (ranges.size() > 0 && ranges.back().second == cl && ranges.back().first.second + 1 == range.first) {
+                ranges.back().first.second = range.second;
+            }
+            else {
+                ranges.push_back(ClassRange{ range, cl });
+            }
+        }
+        DenseDFA table;
+        table.classes = CharacterClassMap{ ranges };
+        table.ranges = std::move(ranges);
+        table.nStates = nodes.size() + 1;
+        table.nClasses = columns.size();
+        table.trans.assign(table.nStates * table.nClasses, DenseDFA::dead);
+        for (const auto& column : columns) {
+            for (Index i = 0; i < column.first.size(); ++i) {
+                table.trans[i * table.nClasses + column.second] = column.first[i];
+            }
+        }
+        table.firstAccept = static_cast<StateIndex>(firstAccept - nodes.begin() + 1);
+        table.start = indexes.find(dfa.first)->second;
+        if (acceptSets.size() > 0) {
+            for (std::vector<DFAnode*>::const_iterator it = firstAccept; it != nodes.end(); ++it) {
+                table.labels.push_back((*it)->label);
+            }
+        }
+        return table;
+    }
+
+    // the function creates the DFA that reads the UTF-8 encoding of the text: the states of 'table' read the first
+    // byte of a character and the states between them read its other bytes, a state that reads k more bytes
+    // is found from the classes of the 64^k characters that the bytes may select, the states with the same
+    // transitions are joined; the bytes that are not a part of a valid sequence lead to the dead state,
+    // so they are not a part of a match
+    DenseDFA Regexp::CreateUtf8DFA() const
+    {
+        constexpr Character nTails = 0x40;                  // number of the values of a continuation byte
+        constexpr Character end = 0x140000;                 // end of the characters selected by the bytes F0..F4
+        constexpr StateIndex dead = DenseDFA::dead;
+        // block k is the list of the blocks k - 1 (of the classes for k = 0) of 64^(k + 1) characters,
+        // the same blocks are numbered once
+        std::vector<std::vector<Index>> unique[3];          // distinct blocks
+        std::vector<Index> blocks[3];                       // number of the block of each 64^(k + 1) characters
+        for (int k = 0; k < 3; ++k) {
+            std::map<std::vector<Index>, Index> numbers;
+            const Character size = nTails << (6 * k);
+            for (Character first = 0; first < end; first += size) {
+                std::vector<Index> block(nTails);
+                for (Character j = 0; j < nTails; ++j) {
+                    block[j] = (k == 0) ? table.Class(first + j) : blocks[k - 1][first / (size / nTails) + j];
+                }
+                const std::pair<std::map<std::vector<Index>, Index>::iterator, bool> pair =
+                    numbers.emplace(block, unique[k].size());
+                if (pair.second) {
+                    unique[k].push_back(std::move(block));
+                }
+                blocks[k].push_back(pair.first->second);
+            }
+        }
+
+        // the states of 'table' are numbered first and the states that read the other bytes follow them
+        const StateIndex n = static_cast<StateIndex>(table.nStates);
+        std::vector<std::vector<StateIndex>> rows;          // transitions of the other states on 0x80..0xBF
+        std::map<std::vector<StateIndex>, StateIndex> states;
+        auto intern = [&](std::vector<StateIndex>&& row) -> StateIndex {
+            if (std::all_of(row.begin(), row.end(), [](const StateIndex q) { return q == dead; })) {
+                return dead;
+            }
+            const std::pair<std::map<std::vector<StateIndex>, StateIndex>::iterator, bool> pair =
+                states.emplace(row, static_cast<StateIndex>(n + rows.size()));
+            if (pair.second) {
+                rows.push_back(std::move(row));
+            }
+            return pair.first->second;
+        };
+        // the state that reads only the continuation bytes [0x80 + lo, 0x80 + hi) of 'q'
+        auto restrict = [&](const StateIndex q, const Character lo, const Character hi) -> StateIndex {
+            if (q == dead) {
+                return dead;
+            }
+            std::vector<StateIndex> row{ rows[q - n] };
+            for (Character j = 0; j < nTails; ++j) {
+                if (j < lo || j >= hi) {
+                    row[j] = dead;
+                }
+            }
+            return intern(std::move(row));
+        };
+        std::vector<StateIndex> lead(n * 256, dead);        // transitions of the states of 'table'
+        std::vector<StateIndex> level[3];                   // the state that reads the block k of the state q
+        for (StateIndex q = 1; q < n; ++q) {
+            CheckTime();
+            for (int k = 0; k < 3; ++k) {
+                level[k].assign(unique[k].size(), dead);
+                for (Index b = 0; b < unique[k].size(); ++b) {
+                    std::vector<StateIndex> row(nTails);
+                    for (Character j = 0; j < nTails; ++j) {
+                        row[j] = (k == 0) ? table.trans[q * table.nClasses + unique[0][b][j]] : level[k - 1][unique[k][b][j]];
+                    }
+                    level[k][b] = intern(std::move(row));
+                }
+            }
+            StateIndex* row = &lead[q * 256];
+            for (Character byte = 0; byte < 0x80; ++byte) {
+                row[byte] = table.Next(q, byte);
+            }
+            for (Character byte = 0xC2; byte < 0xE0; ++byte) {
+                row[byte] = level[0][blocks[0][byte & 0x1F]];
+            }
+            for (Character byte = 0xE0; byte < 0xF0; ++byte) {
+                row[byte] = level[1][blocks[1][byte & 0x0F]];
+            }
+            for (Character byte = 0xF0; byte < 0xF5; ++byte) {
+                row[byte] = level[2][blocks[2][byte & 0x07]];
+            }
+            row[0xE0] = restrict(row[0xE0], 0x20, nTails);  // overlong sequences
+            row[0xED] = restrict(row[0xED], 0, 0x20);       // surrogates
+            row[0xF0] = restrict(row[0xF0], 0x10, nTails);  // overlong sequences
+            row[0xF4] = restrict(row[0xF4], 0, 0x10);       // characters above 0x10FFFF
+        }
+        const size_t nStates = n + rows.size();
+        if (nStates >= std::numeric_limits<StateIndex>::max()) {
+            throw Error::RuntimeError{ "CreateUtf8DFA(): Too many DFA states" };
+        }
+        CheckDFAStates(nStates);
+
+        // the accept states are numbered last
+        const StateIndex nRows = static_cast<StateIndex>(rows.size());
+        auto renumber = [&](const StateIndex q) -> StateIndex {
+            return (q < table.firstAccept) ? q : (q < n) ? q + nRows : table.firstAccept + (q - n);
+        };
+        std::vector<StateIndex> trans(nStates * 256, dead);
+        for (StateIndex q = 0; q < n; ++q) {
+            for (Character byte = 0; byte < 256; ++byte) {
+                trans[renumber(q) * 256 + byte] = renumber(lead[q * 256 + byte]);
+            }
+        }
+        for (StateIndex r = 0; r < nRows; ++r) {
+            for (Character j = 0; j < nTails; ++j) {
+                trans[renumber(n + r) * 256 + 0x80 + j] = renumber(rows[r][j]);
+            }
+        }
+        std::map<std::vector<StateIndex>, ClassIndex> columns;  // column of transitions -> class
+        columns.emplace(std::vector<StateIndex>(nStates, dead), 0);
+        std::vector<ClassRange> ranges;
+        for (Character byte = 0; byte < 256; ++byte) {
+            std::vector<StateIndex> column(nStates);
+            for (Index q = 0; q < nStates; ++q) {
+                column[q] = trans[q * 256 + byte];
+            }
+            const ClassIndex cl = columns.emplace(std::move(column), columns.size()).first->second;
+            if (cl == 0) {
+                continue;
+            }
+            if (ranges.size() > 0 && ranges.back().second == cl && ranges.back().first.second + 1 == byte) {
+                ranges.back().first.second = byte;
+            }
+            else {
+                ranges.push_back(ClassRange{ CharacterRange{ byte, byte }, cl });
+            }
+        }
+        DenseDFA utf8;
+        utf8.classes = CharacterClassMap{ ranges };
+        utf8.ranges = std::move(ranges);
+        utf8.nStates = nStates;
+        utf8.nClasses = columns.size();
+        utf8.trans.assign(utf8.nStates * utf8.nClasses, dead);
+        for (const auto& column : columns) {
+            for (Index q = 0; q < column.first.size(); ++q) {
+                utf8.trans[q * utf8.nClasses + column.second] = column.first[q];
+            }
+        }
+        utf8.firstAccept = table.firstAccept + nRows;
+        utf8.start = renumber(table.start);
+        return utf8;
+    }
+
+    // the function creates the DFA that reads the text backwards and tracks the states of 'forward'
+    // from which an accept state is still reachable, it is the subset construction over the reversed transitions;
+    // the sets may be exponentially many, so an empty ReverseDFA is returned if there are more
+    // than 'Constants::maxReverseStates' of them
+    ReverseDFA Regexp::CreateReverseDFA(const DenseDFA& forward) const
+    {
+        const size_t nLive = forward.Size();
+        std::vector<bool> accept(nLive, false);
+        for (StateIndex q = forward.firstAccept; q < nLive; ++q) {
+            accept[q] = true;
+        }
+        std::unordered_map<std::vector<bool>, StateIndex> indexes;
+        std::vector<const std::vector<bool>*> sets;
+        std::vector<StateIndex> trans;
+        sets.push_back(&indexes.emplace(accept, 0).first->first);
+        for (StateIndex r = 0; r < sets.size(); ++r) {
+            for (ClassIndex cl = 0; cl < forward.nClasses; ++cl) {
+                std::vector<bool> set{ accept };
+                for (StateIndex q = 0; q < nLive; ++q) {
+                    if ((*sets[r])[forward.trans[q * forward.nClasses + cl]]) {
+                        set[q] = true;
+                    }
+                }
+                std::pair<std::unordered_map<std::vector<bool>, StateIndex>::iterator, bool> pair =
+                    indexes.emplace(std::move(set), static_cast<StateIndex>(sets.size()));
+                if (pair.second) {
+                    if (sets.size() >= Constants::maxReverseStates) {
+                        return ReverseDFA{};
+                    }
+                    sets.push_back(&pair.first->first);
+                }
+                trans.push_back(pair.first->second);
+            }
+        }
+        ReverseDFA reverse;
+        reverse.trans = std::move(trans);
+        reverse.nStates = sets.size();
+        reverse.nClasses = forward.nClasses;
+        reverse.nLive = nLive;
+        reverse.live.reserve(sets.size() * nLive);
+        for (const std::vector<bool>* set : sets) {
+            reverse.live.insert(reverse.live.end(), set->begin(), set->end());
+        }
+        reverse.start = 0;
+        std::vector<CharacterRange> wake;
+        for (const ClassRange& r : forward.ranges) {
+            if (reverse.Next(reverse.start, r.second) != reverse.start) {
+                wake.push_back(r.first);
+            }
+        }
+        reverse.wake = CharacterRangeSet{ std::move(wake) };
+        return reverse;
+    }
+
+    // the function finds a literal that every match contains: every path from the start state to an accept state
+    // passes through the dominators of a virtual exit state that follows the accept states, if such a dominator
+    // is entered only on one character or is not an accept state and leaves only on one character, the characters
+    // occur in every match one after another, the rarest of the literals is chosen
+    // 'A Simple, Fast Dominance Algorithm', K. D. Cooper, T. J. Harvey, K. Kennedy (2001)
+    Prefilter Regexp::CreatePrefilter() const
+    {
+        constexpr StateIndex undefined = std::numeric_limits<StateIndex>::max();
+        constexpr size_t maxLength = 64;
+        const StateIndex exit = static_cast<StateIndex>(table.nStates);
+        std::vector<Character> single(table.nClasses, Constants::notCharacter);    // the character of the class
+        std::vector<size_t> nRanges(table.nClasses, 0);
+        for (const ClassRange& r : table.ranges) {
+            if (++nRanges[r.second] == 1 && r.first.first == r.first.second) {
+                single[r.second] = r.first.first;
+            }
+            else {
+                single[r.second] = Constants::notCharacter;
+            }
+        }
+        std::vector<std::vector<StateIndex>> preds(table.nStates + 1);
+        std::vector<std::vector<StateIndex>> succs(table.nStates + 1);
+        std::vector<Character> in(table.nStates, Constants::notCharacter);     // the only character to enter
+        for (StateIndex q = 1; q < table.nStates; ++q) {
+            for (ClassIndex cl = 0; cl < table.nClasses; ++cl) {
+                const StateIndex t = table.trans[q * table.nClasses + cl];
+                if (t == DenseDFA::dead) {
+                    continue;
+                }
+                in[t] = (preds[t].size() == 0 || in[t] == single[cl]) ? single[cl] : Constants::notCharacter;
+                succs[q].push_back(t);
+                preds[t].push_back(q);
+            }
+            if (table.IsAccept(q)) {
+                succs[q].push_back(exit);
+                preds[exit].push_back(q);
+            }
+        }
+        // reverse postorder
+        std::vector<StateIndex> order;
+        std::vector<StateIndex> number(table.nStates + 1, undefined);
+        {
+            std::vector<bool> visited(table.nStates + 1, false);
+            std::vector<std::pair<StateIndex, size_t>> stack{ { table.start, 0 } };
+            visited[table.start] = true;
+            while (stack.size() > 0) {
+                std::pair<StateIndex, size_t>& top = stack.back();
+                if (top.second < succs[top.first].size()) {
+                    const StateIndex t = succs[top.first][top.second++];
+                    if (!visited[t]) {
+                        visited[t] = true;
+                        stack.push_back({ t, 0 });
+                    }
+                    continue;
+                }
+                order.push_back(top.first);
+                stack.pop_back();
+            }
+            std::reverse(order.begin(), order.end());
+            for (StateIndex i = 0; i < order.size(); ++i) {
+                number[order[i]] = i;
+            }
+        }
+        if (number[exit] == undefined) {
+            return Prefilter{};
+        }
+        std::vector<StateIndex> idom(table.nStates + 1, undefined);
+        idom[table.start] = table.start;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (StateIndex i = 1; i < order.size(); ++i) {
+                const StateIndex b = order[i];
+                StateIndex newIdom = undefined;
+                for (const StateIndex p : preds[b]) {
+                    if (idom[p] == undefined) {
+                        continue;
+                    }
+                    if (newIdom == undefined) {
+                        newIdom = p;
+                        continue;
+                    }
+                    StateIndex x = p;
+                    StateIndex y = newIdom;
+                    while (x != y) {
+                        while (number[x] > number[y]) {
+                            x = idom[x];
+                        }
+                        while (number[y] > number[x]) {
+                            y = idom[y];
+                        }
+                    }
+                    newIdom = x;
+                }
+                if (idom[b] != newIdom) {
+                    idom[b] = newIdom;
+                    changed = true;
+                }
+            }
+        }
+        // the frequency of the rarest character, the longer literal wins a tie
+        auto rarer = [](const UString& a, const UString& b) {
+            const unsigned char fa = CharacterFrequency(*std::min_element(a.begin(), a.end(),
+                [](Character x, Character y) { return CharacterFrequency(x) < CharacterFrequency(y); }));
+            const unsigned char fb = CharacterFrequency(*std::min_element(b.begin(), b.end(),
+                [](Character x, Character y) { return CharacterFrequency(x) < CharacterFrequency(y); }));
+            return fa < fb || (fa == fb && a.size() > b.size());
+        };
+        UString best;
+        for (StateIndex d = idom[exit]; ; d = idom[d]) {
+            UString chain;
+            // the start state is also entered before the first character
+            if (d != table.start && in[d] != Constants::notCharacter) {
+                chain += in[d];
+            }
+            // the characters on which the dominator and the following states are left
+            StateIndex q = d;
+            while (!table.IsAccept(q) && chain.size() < maxLength) {
+                ClassIndex out = 0;
+                size_t nOut = 0;
+                for (ClassIndex cl = 0; cl < table.nClasses; ++cl) {
+                    if (table.trans[q * table.nClasses + cl] != DenseDFA::dead) {
+                        out = cl;
+                        ++nOut;
+                    }
+                }
+                if (nOut != 1 || single[out] == Constants::notCharacter) {
+                    break;
+                }
+                chain += single[out];
+                q = table.trans[q * table.nClasses + out];
+            }
+            if (chain.size() > 0 && (best.size() == 0 || rarer(chain, best))) {
+                best = chain;
+            }
+            if (d == table.start) {
+                break;
+            }
+        }
+        return (best.size() < 2) ? Prefilter{} : Prefilter{ best };
+    }
+
+    // the function creates a DFA with one node per block of equivalent 'nodes',
+    // adjacent ranges of the transitions to the same node are merged
+    DFA Regexp::CreateMinimalDFA(const std::vector<DFAnode*>& nodes, const std::vector<Index>& blocks) const
+    {
+        DFA newDFA;
+        const size_t nBlocks = (nodes.size() == 0) ? 0 : *std::max_element(blocks.begin(), blocks.end()) + 1;
+        std::vector<DFAnode*> newNodes(nBlocks, nullptr);
+        std::vector<Index> representatives(nBlocks);
+        for (Index i = nodes.size(); i > 0; --i) {
+            representatives[blocks[i - 1]] = i - 1;
+        }
+        for (Index b = 0; b < nBlocks; ++b) {
+            newNodes[b] = newDFA.CreateDFANode(nodes[representatives[b]]->acc, nodes[representatives[b]]->label);
+        }
+        std::unordered_map<const DFAnode*, Index> indexes;
+        for (Index i = 0; i < nodes.size(); ++i) {
+            indexes.emplace(nodes[i], i);
+        }
+        for (Index b = 0; b < nBlocks; ++b) {
+            TransitionTable& trans = newNodes[b]->trans;
+            for (const Transition& t : nodes[representatives[b]]->trans) {
+                DFAnode* target = newNodes[blocks[indexes.find(t.second)->second]];
+                if (trans.size() > 0 && trans.back().second == target
+                    && trans.back().first.second + 1 == t.first.first) {
+                    trans.back().first.second = t.first.second;
+                }
+                else {
+                    trans.push_back(Transition{ t.first, target });
+                }
+            }
+        }
+        newDFA.first = newNodes[blocks[indexes.find(dfa.first)->second]];
+        newDFA.sz = newNodes.size();
+        return newDFA;
+    }
+
+    // the function splits the (possibly overlapping) ranges of the NFA into sorted disjoint ranges,
+    // each NFA range is a union of some of them
+    std::vector<CharacterRange> Regexp::PartitionAlphabet() const
+    {
+        std::map<Character, int> bounds;                        // bound -> change of the number of covering ranges
+        for (const CharacterRange& range : alphabetTemp) {
+            ++bounds[range.first];
+            --bounds[range.second + 1];
+        }
+        std::vector<CharacterRange> partition;
+        int cover{ 0 };
+        std::map<Character, int>::const_iterator it = bounds.begin();
+        while (it != bounds.end()) {
+            cover += it->second;
+            const Character first = it->first;
+            if (++it != bounds.end() && cover > 0) {
+                partition.push_back(CharacterRange{ first, it->first - 1 });
+            }
+        }
+        return partition;
+    }
+
+    inline bool Regexp::IsNewLineSymbol(const Character ch) const
+    {
+        switch (ch) {
+        case CTRL_LF:
+        case CTRL_CR:
+        case CTRL_LS:
+        case CTRL_PS:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    inline void Regexp::AdjustPositions(
+        std::u32string::const_iterator begin,
+        std::u32string::const_iterator end,
+        size_t& line,
+        size_t& pos) const
+    {
+        if (begin == end) {
+            return;
+        }
+        const char32_t* first = &*begin;
+        const char32_t* last = first + (end - begin);
+        const size_t count = newLines.Count(first, last);
+        if (count == 0) {
+            pos += last - first;
+        }
+        else {
+            line += count;
+            pos = last - newLines.FindLast(first, last);
+        }
+    }
+
+    // the same as above for the UTF-8 text: the positions are counted in characters, LF, CR, LS and PS
+    // are the new line characters
+    inline void Regexp::AdjustPositions(
+        const unsigned char* first,
+        const unsigned char* last,
+        size_t& line,
+        size_t& pos) const
+    {
+        const unsigned char* lineStart = nullptr;   // the last new line character
+        for (const unsigned char* p = first; p < last; ++p) {
+            if (*p == CTRL_LF || *p == CTRL_CR) {
+                ++line;
+                lineStart = p;
+            }
+            else if (*p == 0xE2 && last - p >= 3 && p[1] == 0x80 && (p[2] == 0xA8 || p[2] == 0xA9)) {
+                ++line;
+                lineStart = p;
+                p += 2;
+            }
+        }
+        if (lineStart != nullptr) {
+            pos = 0;
+            first = lineStart;
+        }
+        pos += std::count_if(first, last, [](const unsigned char byte) { return (byte & 0xC0) != 0x80; });
+    }
+
+#if REGEX_PRINT_FA_STATE
+    void Regexp::MakeDFA()
+    {
+        std::cout << std::endl << "RE: " << GetGlyph(this->source) << std::endl;
+        std::vector<UString> strings;
+        const bool utf8 = FLAG_IS_SET(fl, REGFL_UTF8);         // the DFA is needed for the UTF-8 DFA
+        if (PStrings(strings)) {
+            for (const UString& string : strings) {
+                std::cout << "String: " << GetGlyph(string) << std::endl;
+            }
+            if (strings.size() == 1) {
+                literal = LiteralSearcher{ strings[0] };
+            }
+            else {
+                keywords = AhoCorasick{ strings };
+            }
+            if (!utf8) {
+                return;
+            }
+        }
+        ts.Reset();
+        REtoNFA();
+        PrintNFA(std::cout, *this);
+        if (FLAG_IS_SET(fl, REGFL_LAZYDFA)) {
+            MakeLazyDFA();
+            if (!utf8) {
+                return;
+            }
+        }
+        else {
+            // NFAtoDFA releases the NFA, the lazy DFA only keeps its indexes
+            fallback = LazyDFA{ IndexedNFA{ nfa }, alphabet, cacheSize };
+        }
+        std::vector<DFAnode*> nodes = NFAtoDFA();
+        std::cout << std::endl << "RE: " << GetGlyph(this->source) << std::endl;
+        PrintDFA(std::cout, *this);
+        MinimizeDFA(nodes);
+        std::cout << std::endl << "RE: " << GetGlyph(this->source) << std::endl;
+        PrintDFA(std::cout, *this);
+        CheckTime();
+        table = CreateDenseDFA();
+        CheckTime();
+        prefilter = CreatePrefilter();
+        if (utf8) {
+            utf8Table = CreateUtf8DFA();
+        }
+        dfa = DFA{};
+    }
+#else
+    void Regexp::MakeDFA()
+    {
+        std::vector<UString> strings;
+        const bool utf8 = FLAG_IS_SET(fl, REGFL_UTF8);         // the DFA is needed for the UTF-8 DFA
+        if (PStrings(strings)) {
+            if (strings.size() == 1) {
+                literal = LiteralSearcher{ strings[0] };
+            }
+            else {
+                keywords = AhoCorasick{ strings };
+            }
+            if (!utf8) {
+                return;
+            }
+        }
+        ts.Reset();
+        REtoNFA();
+        if (FLAG_IS_SET(fl, REGFL_LAZYDFA)) {
+            MakeLazyDFA();
+            if (!utf8) {
+                return;
+            }
+        }
+        else {
+            // NFAtoDFA releases the NFA, the lazy DFA only keeps its indexes
+            fallback = LazyDFA{ IndexedNFA{ nfa }, alphabet, cacheSize };
+        }
+        MinimizeDFA(NFAtoDFA());
+        CheckTime();
+        table = CreateDenseDFA();
+        CheckTime();
+        prefilter = CreatePrefilter();
+        if (utf8) {
+            utf8Table = CreateUtf8DFA();
+        }
+        dfa = DFA{};
+    }
+#endif // REGEX_PRINT_FA_STATE
+
+    // the patterns are parsed one by one and their NFAs are joined, each pattern keeps its accept node;
+    // the unanchored NFA begins with a loop on all the characters, so its DFA finds the matches that end
+    // at each position of the text
+    void Regexp::MakeSetDFA(const std::vector<UString>& patterns, const bool unanchored)
+    {
+        for (Index k = 0; k < patterns.size(); ++k) {
+            if (patterns[k].size() == 0) {
+                throw Error::InvalidRegex{ "Empty regular expression " };
+            }
+            source = patterns[k];
+            ts.Reset();
+            NFA a = PGoal();
+            if (token.second != Regexp::TokenStream::TokenType::EOS) {
+                ThrowInvalidRegexCharacter(ts.GetPosition());
+            }
+            const IndexedNFA inf{ a };
+            if (std::binary_search(inf.ClosureBegin(inf.first), inf.ClosureEnd(inf.first), inf.last)) {
+                ThrowInvalidRegex("This regular expression is invalid. It matches any string");
+            }
+            lasts.push_back(a.GetLastNode());
+            if (k == 0) {
+                nfa = std::move(a);
+            }
+            else {
+                nfa.Join(a);
+            }
+            CheckNFANodes(nfa.Size());
+        }
+        if (unanchored) {
+            const CharacterRange any{ 0, Constants::maxCharacter };
+            NFA loop{ any };
+            loop.ClosureKleene();
+            loop.Concatenate(nfa);
+            nfa = std::move(loop);
+            AddToAlphabet(any);
+        }
+        MakeAlphabet();
+        MinimizeDFA(NFAtoDFA());
+        CheckTime();
+        table = CreateDenseDFA();
+        dfa = DFA{};
+    }
+
+    // Thompsons Construction
+    // CHAPTER 2 Scanners, 2.4 FROM REGULAR EXPRESSION TO SCANNER, 2.4.2 Regular Expression to NFA: Thompsons Construction
+    void Regexp::REtoNFA()
+    {
+        nfa = PGoal();
+        if (token.second != Regexp::TokenStream::TokenType::EOS) {
+            ThrowInvalidRegexCharacter(ts.GetPosition());
+        }
+        MakeAlphabet();
+    }
+
+    void Regexp::MakeAlphabet()
+    {
+        alphabet = PartitionAlphabet();
+        alphabetTemp.clear();
+        if (options.maxAlphabetSize != 0 && alphabet.size() > options.maxAlphabetSize) {
+            ThrowCompileLimitExceeded("The alphabet has more than "
+                + std::to_string(options.maxAlphabetSize) + " ranges");
+        }
+    }
+
+    // the NFA is kept, the DFA states are created by Match and Search
+    void Regexp::MakeLazyDFA()
+    {
+        lazy = LazyDFA{ IndexedNFA{ nfa }, alphabet, cacheSize };
+        if (lazy.AcceptsEmpty()) {
+            ThrowInvalidRegex("This regular expression is invalid. It matches any string");
+        }
+    }
+
+    // Subset Construction
+    // CHAPTER 2 Scanners, 2.4 FROM REGULAR EXPRESSION TO SCANNER, 2.4.3 NFA to DFA: The Subset Construction
+    // FIGURE 2.6 The Subset Construction
+    std::vector<DFAnode*> Regexp::NFAtoDFA()
+    {
+        const IndexedNFA inf{ nfa };
+        // the positions of the counters are nodes here
+        CheckNFANodes(inf.Size());
+        SparseSet reached{ inf.Size() };
+        reached.Insert(inf.first);
+        StateSet first = EpsilonClosure(inf, reached);
+        if (std::binary_search(first.begin(), first.end(), inf.last)) {
+            ThrowInvalidRegex("This regular expression is invalid. It matches any string");
+        }
+        SubsetMap subsets;
+        SubsetTable table;
+        table.push_back(SubsetTableEntry{ &subsets.emplace(std::move(first), 0).first->first,
+            std::vector<SubsetTableIndex>(alphabet.size(), noTransition) });
+        std::queue<SubsetTableIndex> workList;
+        workList.push(0);
+        while (workList.size() > 0) {
+            CheckTime();
+            SubsetTableIndex i = workList.front();
+            workList.pop();
+            for (size_t k = 0; k < alphabet.size(); ++k) {
+                Delta(inf, *table[i].state, alphabet[k], reached);
+                if (reached.Size() == 0) {
+                    continue;
+                }
+                std::pair<SubsetMap::iterator, bool> pair =
+                    subsets.emplace(EpsilonClosure(inf, reached), static_cast<SubsetTableIndex>(table.size()));
+                if (pair.second) {
+                    CheckDFAStates(table.size() + 1);
+                    table.push_back(SubsetTableEntry{ &pair.first->first,
+                        std::vector<SubsetTableIndex>(alphabet.size(), noTransition) });
+                    workList.push(pair.first->second);
+                }
+                table[i].trans[k] = pair.first->second;
+            }
+        }
+        std::vector<DFAnode*> nodes;
+        nodes.reserve(table.size());
+        if (lasts.size() == 0) {
+            for (const SubsetTableEntry& entry : table) {
+                nodes.push_back(dfa.CreateDFANode(std::binary_search(entry.state->begin(), entry.state->end(), inf.last)));
+            }
+        }
+        else {
+            // the label of a state is the index of the set of the patterns whose last nodes it contains
+            std::unordered_map<const NFAnode*, Index> patterns;
+            for (Index k = 0; k < lasts.size(); ++k) {
+                patterns.emplace(lasts[k], k);
+            }
+            std::vector<Index> patternOf(inf.Size(), IndexedNFA::none);
+            for (Index i = 0; i < inf.nodes.size(); ++i) {
+                const std::unordered_map<const NFAnode*, Index>::const_iterator it = patterns.find(inf.nodes[i]);
+                if (it != patterns.end()) {
+                    patternOf[i] = it->second;
+                }
+            }
+            std::map<std::vector<Index>, Index> labels;
+            std::vector<Index> set;
+            for (const SubsetTableEntry& entry : table) {
+                set.clear();
+                for (const Index i : *entry.state) {
+                    if (patternOf[i] != IndexedNFA::none) {
+                        set.push_back(patternOf[i]);
+                    }
+                }
+                if (set.size() == 0) {
+                    nodes.push_back(dfa.CreateDFANode(false));
+                    continue;
+                }
+                std::sort(set.begin(), set.end());
+                const std::pair<std::map<std::vector<Index>, Index>::iterator, bool> pair =
+                    labels.emplace(set, acceptSets.size());
+                if (pair.second) {
+                    acceptSets.push_back(set);
+                }
+                nodes.push_back(dfa.CreateDFANode(true, pair.first->second));
+            }
+            lasts.clear();
+        }
+        for (SubsetTableIndex i = 0; i < table.size(); ++i) {
+            SubsetTableEntry& entry = table[i];
+            for (size_t j = 0; j < entry.trans.size(); ++j) {
+                SubsetTableIndex index = entry.trans[j];
+                if (index == noTransition) {
+                    continue;
+                }
+                nodes[i]->trans.push_back(Transition{ alphabet[j], nodes[index] });
+            }
+        }
+        nfa = NFA{ Constants::notCharacter };
+        dfa.first = nodes[0];
+        dfa.sz = table.size();
+        return nodes;
+    }
+
+    // Hopcrofts Algorithm
+    // CHAPTER 2 Scanners, 2.4 FROM REGULAR EXPRESSION TO SCANNER, 2.4.4 DFA to Minimal DFA: Hopcrofts Algorithm
+    // FIGURE 2.9 DFA Minimization Algorithm
+    // the partition is refined by the worklist algorithm of 'PartitionStates', nodes[0] is the start node
+    void Regexp::MinimizeDFA(const std::vector<DFAnode*> nodes)
+    {
+        std::unordered_map<const DFAnode*, Index> indexes;
+        for (Index i = 0; i < nodes.size(); ++i) {
+            indexes.emplace(nodes[i], i);
+        }
+        // the accept nodes are split by their labels, the other nodes follow them
+        const Index notAccept = std::max<Index>(acceptSets.size(), 1);
+        std::vector<Index> labels(nodes.size());
+        std::vector<NumberedTransition> trans;
+        for (Index i = 0; i < nodes.size(); ++i) {
+            labels[i] = nodes[i]->acc ? nodes[i]->label : notAccept;
+            for (const Transition& t : nodes[i]->trans) {
+                const Index to = indexes.find(t.second)->second;
+                std::vector<CharacterRange>::const_iterator it = std::lower_bound(alphabet.begin(), alphabet.end(),
+                    CharacterRange{ t.first.first, t.first.first });
+                while (it != alphabet.end() && it->second <= t.first.second) {
+                    trans.push_back(NumberedTransition{ i, static_cast<Index>(it - alphabet.begin()), to });
+                    ++it;
+                }
+            }
+        }
+        dfa = CreateMinimalDFA(nodes, PartitionStates(labels, trans));
+    }
+
+    // parse Goal
+    // parse the regular expression as an alternation of strings of characters, the function returns false
+    // when it meets another operator or an empty string, and the regular expression must be parsed again by PGoal
+    bool Regexp::PStrings(std::vector<UString>& strings)
+    {
+        NextToken();
+        strings.push_back(UString{});
+        while (token.second != Regexp::TokenStream::TokenType::EOS) {
+            if (token.second == Regexp::TokenStream::TokenType::SPECIAL && token.first == SPEC_BAR) {
+                if (strings.back().size() == 0) {
+                    return false;
+                }
+                strings.push_back(UString{});
+                NextToken();
+                continue;
+            }
+            if (token.second == Regexp::TokenStream::TokenType::SPECIAL && token.first != SPEC_BSLASH) {
+                return false;
+            }
+            strings.back() += PCharacter(Constants::AtomType::STANDART);
+        }
+        return strings.back().size() != 0;
+    }
+
+    NFA Regexp::PGoal()
+    {
+        NextToken();
+        return PAlternation();
+    }
+
+    // parse Alternation
+    NFA Regexp::PAlternation()
+    {
+        NFA a = PConcatenation();
+        PAlternationPrime(a);
+        return a;
+    }
+
+    // parse Alternation'
+    void Regexp::PAlternationPrime(NFA& a)
+    {
+        switch (token.second) {
+        case Regexp::TokenStream::TokenType::EOS:
+            return;
+        case Regexp::TokenStream::TokenType::SPECIAL:
+            switch (token.first) {
+            case SPEC_RPAR:
+                return;
+            case SPEC_BAR:
+                NextToken();
+                a.Alternate(PConcatenation());
+                CheckNFANodes(a.Size());
+                PAlternationPrime(a);
+                return;
+            default:
+                break;
+            }
+        case Regexp::TokenStream::TokenType::LITERAL:
+            break;
+        default:
+            break;
+        }
+        ThrowInvalidRegexCharacter(ts.GetPosition());
+    }
+
+    // parse Concatenation
+    NFA Regexp::PConcatenation()
+    {
+        NFA a = PTerm();
+        PConcatenationPrime(a);
+        return a;
+    }
+
+    // parse Concatenation'
+    void Regexp::PConcatenationPrime(NFA& a)
+    {
+        switch (token.second) {
+        case Regexp::TokenStream::TokenType::EOS:
+            return;
+        case Regexp::TokenStream::TokenType::SPECIAL:
+            switch (token.first) {
+            case SPEC_LPAR:
+            case SPEC_LBRACKET:
+            case SPEC_BSLASH:
+                a.Concatenate(PTerm());
+                CheckNFANodes(a.Size());
+                PConcatenationPrime(a);
+                return;
+            case SPEC_RPAR:
+            case SPEC_BAR:
+                return;
+            default:
+                break;
+            }
+        case Regexp::TokenStream::TokenType::LITERAL:
+            a.Concatenate(PTerm());
+            CheckNFANodes(a.Size());
+            PConcatenationPrime(a);
+            return;
+        default:
+            break;
+        }
+        ThrowInvalidRegexCharacter(ts.GetPosition());
+    }
+
+    // parse Term
+    NFA Regexp::PTerm()
+    {
+        NFA a = PBlock();
+        PClosure(a);
+        return a;
+    }
+
+    // parse Block
+    NFA Regexp::PBlock()
+    {
+        switch (token.second) {
+        case Regexp::TokenStream::TokenType::SPECIAL:
+            switch (token.first) {
+            case SPEC_LPAR: {
+                NextToken();
+                NFA a = PAlternation();
+                if (token.first == SPEC_RPAR) {
+                    NextToken();
+                    return a;
+                }
+                break;
+            }
+            case SPEC_LBRACKET: {
+                NextToken();
+                NFA a = PCharacterClass();
+                if (token.first == SPEC_RBRACKET) {
+                    NextToken();
+                    return a;
+                }
+                break;
+            }
+            default:
+                return PAtom();
+            }
+            break;
+        default:
+            return PAtom();
+        }
+        ThrowInvalidRegexCharacter(ts.GetPosition());
+    }
+
+    // parse CharacterClass
+    NFA Regexp::PCharacterClass()
+    {
+        const bool negated = PNegation();
+        std::vector<CharacterRange> ranges;
+        PCharacterClassRange(ranges);
+        return MakeCharacterClass(ranges, negated);
+    }
+
+    // parse Negation
+    bool Regexp::PNegation()
+    {
+        if (token.first == LIT_CARET) {
+            NextToken();
+            return true;
+        }
+        return false;
+    }
+
+    // parse CharacterClassRange
+    void Regexp::PCharacterClassRange(std::vector<CharacterRange>& ranges)
+    {
+        const Character ch = PCharacter(Constants::AtomType::CHARCLASS);
+        ranges.push_back(CharacterRange{ ch, ch });
+        PCharacterClassRangePrime(ranges);
+    }
+
+    // parse CharacterClassRange'
+    void Regexp::PCharacterClassRangePrime(std::vector<CharacterRange>& ranges)
+    {
+        switch (token.second) {
+        case Regexp::TokenStream::TokenType::EOS:
+            return;
+        case Regexp::TokenStream::TokenType::SPECIAL:
+            switch (token.first) {
+            case SPEC_RBRACKET:
+                return;
+            default: {
+                const Character ch = PCharacter(Constants::AtomType::CHARCLASS);
+                ranges.push_back(CharacterRange{ ch, ch });
+                PCharacterClassRangePrime(ranges);
+                return;
+            }
+            }
+            break;
+        case Regexp::TokenStream::TokenType::LITERAL: {
+            if (token.first == LIT_HYPHEN) {
+                const Character firstChar = ranges.back().second;
+                NextToken();
+                const Character lastChar = PCharacter(Constants::AtomType::CHARCLASS);
+                CheckRange(firstChar, lastChar);
+                ranges.push_back(CharacterRange{ firstChar, lastChar });
+                PCharacterClassRangePrime(ranges);
+                return;
+            }
+            const Character ch = PCharacter(Constants::AtomType::CHARCLASS);
+            ranges.push_back(CharacterRange{ ch, ch });
+            PCharacterClassRangePrime(ranges);
+            return;
+        }
+        default:
+            break;
+        }
+        ThrowInvalidRegexCharacter(ts.GetPosition());
+    }
+
+    void RE::Regexp::CheckRange(Character first, Character last)
+    {
+        constexpr size_t qty = 3;
+        first = FLAGS_UNSET(first, CHARFL_ALLFLAGS);
+        last = FLAGS_UNSET(last, CHARFL_ALLFLAGS);
+        if (first >= last) {
+            ThrowInvalidRegexRange(ts.GetPosition(), ts.GetSubstring(qty));
+        }
+    }
+
+    // parse Atom
+    NFA RE::Regexp::PAtom()
+    {
+        if (token.second == Regexp::TokenStream::TokenType::SPECIAL && token.first == SPEC_DOT) {
+            NextToken();
+            return PNotNewline();
+        }
+        const Character ch = PCharacter(Constants::AtomType::STANDART);
+        AddToAlphabet(CharacterRange{ ch, ch });
+        return NFA{ ch };
+    }
+
+    // parse '.' (dot)
+    NFA RE::Regexp::PNotNewline()
+    {
+        std::vector<CharacterRange> ranges{
+            CharacterRange{ CTRL_LF, CTRL_LF },
+            CharacterRange{ CTRL_CR, CTRL_CR },
+            CharacterRange{ CTRL_LS, CTRL_PS }
+        };
+        return MakeCharacterClass(ranges, true);
+    }
+
+    // parse a single character of Atom or CharacterClassRange
+    Character RE::Regexp::PCharacter(const Constants::AtomType type)
+    {
+        switch (token.second) {
+        case Regexp::TokenStream::TokenType::EOS:
+            break;
+        case Regexp::TokenStream::TokenType::SPECIAL:
+            switch (token.first) {
+            case SPEC_BSLASH:
+                NextToken(false);
+                return PEscape(type);
+            case SPEC_LBRACKET:
+            case SPEC_RBRACKET:
+                break;
+            default:
+                if (type == Constants::AtomType::CHARCLASS) {
+                    const Character ch = token.first;
+                    NextToken();
+                    return ch;
+                }
+                break;
+            }
+            break;
+        case Regexp::TokenStream::TokenType::LITERAL: {
+            const Character ch = token.first;
+            NextToken();
+            return ch;
+        }
+        default:
+            break;
+        }
+        ThrowInvalidRegexCharacter(ts.GetPosition());
+    }
+
+    // parse Escape
+    Character RE::Regexp::PEscape(const Constants::AtomType type)
+    {
+        switch (token.second) {
+        case Regexp::TokenStream::TokenType::EOS:
+            break;
+        case Regexp::TokenStream::TokenType::SPECIAL: {
+            const Character ch = token.first;
+            NextToken();
+            return ch;
+        }
+        case Regexp::TokenStream::TokenType::LITERAL: {
+            Character ch = Constants::notCharacter;
+            if (!PIsEscape(ch, type)) {
+                ch = token.first;
+            }
+            NextToken();
+            return ch;
+        }
+        default:
+            break;
+        }
+        ThrowInvalidRegexCharacter(ts.GetPosition());
+    }
+
+    // parse ESCAPE
+    bool RE::Regexp::PIsEscape(Character& ch, const Constants::AtomType type)
+    {
+        switch (token.first) {
+        case ESC_0:
+            ch = CTRL_NULL;
+            return true;
+        case ESC_b:
+            if (type == Constants::AtomType::CHARCLASS) {
+                ch = CTRL_BS;
+                return true;
+            }
+            return false;
+        case ESC_t:
+            ch = CTRL_TAB;
+            return true;
+        case ESC_n:
+            ch = CTRL_LF;
+            return true;
+        case ESC_v:
+            ch = CTRL_VT;
+            return true;
+        case ESC_f:
+            ch = CTRL_FF;
+            return true;
+        case ESC_r:
+            ch = CTRL_CR;
+            return true;
+        case ESC_c:
+            NextToken(false);
+            ch = PGetControlCode();
+            return true;
+        case ESC_x:
+            NextToken(false);
+            ch = PGetASCIICharacter();
+            return true;
+        case ESC_u: {
+            NextToken(false);
+            ch = PGetUnicodeCharacter(Constants::unicodeDigits_4);
+            return true;
+        }
+        case ESC_U: {
+            NextToken(false);
+            ch = PGetUnicodeCharacter(Constants::unicodeDigits_6);
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    // parse ESCAPE '\c'
+    Character RE::Regexp::PGetControlCode()
+    {
+        constexpr size_t qty = 1;
+        const Character ch{ token.first };
+        if (ch >= 'a' && ch <= 'z') {
+            return static_cast<Character>(static_cast<unsigned int>(ch) - ('a' - 1));
+        }
+        else if (ch >= 'A' && ch <= 'Z') {
+            return static_cast<Character>(static_cast<unsigned int>(ch) - ('A' - 1));
+        }
+        NextToken();
+        ThrowInvalidRegexEscape(ts.GetPosition(), ts.GetSubstring(qty));
+    }
+
+    // parse ESCAPE '\x'
+    Character RE::Regexp::PGetASCIICharacter()
+    {
+        constexpr size_t qty = 1;
+        const Character ch1{ token.first };
+        NextToken(false);
+        const Character ch2{ token.first };
+        if (isxdigit(ch1) && isxdigit(ch2)) {
+            std::istringstream iss{ std::string{ static_cast<char>(ch1) } + static_cast<char>(ch2) };
+            unsigned int value{ 0 };
+            iss >> std::hex >> value;
+            if (iss && value >= 0x00 && value <= 0x7F) {
+                return static_cast<Character>(value);
+            }
+        }
+        NextToken();
+        ThrowInvalidRegexEscape(ts.GetPosition(), ts.GetSubstring(qty));
+    }
+
+    // parse ESCAPE '\u' and '\U'
+    Character RE::Regexp::PGetUnicodeCharacter(const int nDigits)
+    {
+        constexpr size_t qty = 1;
+        std::string s;
+        bool valid{ true };
+        for (size_t i = 0; i < nDigits; ++i) {
+            if (isxdigit(token.first)) {
+                s += static_cast<char>(token.first);
+            }
+            else {
+                valid = false;
+            }
+            if (i < nDigits - 1) {
+                NextToken(false);
+            }
+        }
+        if (valid) {
+            std::istringstream iss{ s };
+            unsigned long long int value{ 0 };
+            iss >> std::hex >> value;
+            if (iss) {
+                if (nDigits == Constants::unicodeDigits_4 && value >= BASICPLANE_MIN
+                    && value <= BASICPLANE_MAX) {
+                    return static_cast<Character>(value);
+                }
+                else if (nDigits == Constants::unicodeDigits_6 && value >= ALLSUPPLEMENTARYPLANES_MIN
+                    && value <= ALLSUPPLEMENTARYPLANES_MAX) {
+                    return static_cast<Character>(value);
+                }
+            }
+        }
+        NextToken();
+        ThrowInvalidRegexEscape(ts.GetPosition(), ts.GetSubstring(qty));
+    }
+
+    // parse Closure
     void Regexp::PClosure(NFA& a)
     {
-        switch (token.second) {
-        case Regexp::TokenStream::TokenType::EOS:
-            return;
-        case Regexp::TokenStream::TokenType::SPECIAL:
-            switch (token.first) {
-            case SPEC_STAR:
-                a.ClosureKleene();
-                NextToken();
-                return;
-            case SPEC_PLUS:
-                a.ClosurePositive();
-                NextToken();
-                return;
-            case SPEC_QUESTION:
-                a.ClosureBinary();
-                NextToken();
-                return;
-            case SPEC_LBRACE: {
-                NextToken();
-                int min{ -1 };
-                int max{ -1 };
-                Constants::ClosureType type{ Constants::ClosureType::NOTYPE };
-                PCount(min, max, type);
-                if (token.first != SPEC_RBRACE) {
+        switch (token.second) {
+        case Regexp::TokenStream::TokenType::EOS:
+            return;
+        case Regexp::TokenStream::TokenType::SPECIAL:
+            switch (token.first) {
+            case SPEC_STAR:
+                a.ClosureKleene();
+                NextToken();
+                return;
+            case SPEC_PLUS:
+                a.ClosurePositive();
+                NextToken();
+                return;
+            case SPEC_QUESTION:
+                a.ClosureBinary();
+                NextToken();
+                return;
+            case SPEC_LBRACE: {
+                NextToken();
+                int min{ -1 };
+                int max{ -1 };
+                Constants::ClosureType type{ Constants::ClosureType::NOTYPE };
+                PCount(min, max, type);
+                if (token.first != SPEC_RBRACE) {
+                    break;
+                }
+                // the copies are not made if the NFA would be too large
+                CheckNFANodes(a.CustomClosureSize(min, max, type));
+                CheckTime();
+                try {
+                    a.ClosureCustom(min, max, type);
+                }
+                catch (const Error::InvalidRegex& e) {
+                    ThrowInvalidRegex(e.what());
+                }
+                NextToken();
+                return;
+            }
+            case SPEC_LPAR:
+            case SPEC_RPAR:
+            case SPEC_DOT:
+            case SPEC_LBRACKET:
+            case SPEC_BSLASH:
+            case SPEC_BAR:
+                return;
+            default:
+                break;
+            }
+            break;
+        case Regexp::TokenStream::TokenType::LITERAL:
+            return;
+        default:
+            break;
+        }
+        ThrowInvalidRegexCharacter(ts.GetPosition());
+    }
+
+    // parse Count
+    void Regexp::PCount(int& min, int& max, Constants::ClosureType& ty)
+    {
+        switch (token.second) {
+        case Regexp::TokenStream::TokenType::EOS:
+            break;
+        case Regexp::TokenStream::TokenType::SPECIAL:
+            break;
+        case Regexp::TokenStream::TokenType::LITERAL:
+            if (isdigit(token.first)) {
+                min = PGetInteger();
+                ty = Constants::ClosureType::FINITE;
+                PCountMore(max, ty);
+                return;
+            }
+            break;
+        default:
+            break;
+        }
+        ThrowInvalidRegexCharacter(ts.GetPosition());
+    }
+
+    // parse CountMore
+    void Regexp::PCountMore(int& max, Constants::ClosureType& ty)
+    {
+        switch (token.second) {
+        case Regexp::TokenStream::TokenType::EOS:
+            return;
+        case Regexp::TokenStream::TokenType::SPECIAL:
+            switch (token.first) {
+            case SPEC_RBRACE:
+                return;
+            default:
+                break;
+            }
+            break;
+        case Regexp::TokenStream::TokenType::LITERAL:
+            switch (token.first) {
+            case LIT_COMMA:
+                ty = Constants::ClosureType::INFITITE;
+                NextToken();
+                PMax(max, ty);
+                return;
+            default:
+                break;
+            }
+            break;
+        default:
+            break;
+        }
+        ThrowInvalidRegexCharacter(ts.GetPosition());
+    }
+
+    // parse Max
+    void Regexp::PMax(int& max, Constants::ClosureType& ty)
+    {
+        switch (token.second) {
+        case Regexp::TokenStream::TokenType::EOS:
+            return;
+        case Regexp::TokenStream::TokenType::SPECIAL:
+            switch (token.first) {
+            case SPEC_RBRACE:
+                return;
+            default:
+                break;
+            }
+            break;
+        case Regexp::TokenStream::TokenType::LITERAL:
+            if (isdigit(token.first)) {
+                max = PGetInteger();
+                ty = Constants::ClosureType::RANGE;
+                return;
+            }
+            break;
+        default:
+            break;
+        }
+        ThrowInvalidRegexCharacter(ts.GetPosition());
+    }
+
+    // parse INTEGER
+    int Regexp::PGetInteger()
+    {
+        std::string s;
+        while (isdigit(token.first)) {
+            s += token.first;
+            NextToken();
+        }
+        return atoi(s.c_str());
+    }
+
+    // the function merges overlapping and adjacent 'ranges' and creates an alternation of them,
+    // a negated class is replaced by the complementary ranges in [0, maxCharacter]
+    NFA Regexp::MakeCharacterClass(std::vector<CharacterRange>& ranges, const bool negated)
+    {
+        std::sort(ranges.begin(), ranges.end());
+        std::vector<CharacterRange> merged;
+        merged.reserve(ranges.size());
+        for (const CharacterRange& range : ranges) {
+            if (merged.size() > 0 && range.first <= merged.back().second + 1) {
+                merged.back().second = std::max(merged.back().second, range.second);
+            }
+            else {
+                merged.push_back(range);
+            }
+        }
+        if (negated) {
+            std::vector<CharacterRange> complement;
+            complement.reserve(merged.size() + 1);
+            Character first{ 0 };
+            for (const CharacterRange& range : merged) {
+                if (range.first > first) {
+                    complement.push_back(CharacterRange{ first, range.first - 1 });
+                }
+                first = range.second + 1;
+            }
+            if (first <= Constants::maxCharacter) {
+                complement.push_back(CharacterRange{ first, Constants::maxCharacter });
+            }
+            merged.swap(complement);
+        }
+        NFA a{ Constants::notCharacter };
+        for (Index i = 0; i < merged.size(); ++i) {
+            const CharacterRange& range = merged[i];
+            AddToAlphabet(range);
+            if (i == 0) {
+                a = NFA{ range };
+            }
+            else {
+                a.Alternate(NFA{ range });
+            }
+        }
+        return a;
+    }
+
+    void Regexp::ThrowInvalidRegexCharacter(const size_t position) const
+    {
+        std::string message{ "Invalid character '" };
+        if (position < source.size()) {
+            message += GetGlyph(source[position]);
+        }
+        else {
+            message += Strings::eof;
+        }
+        message += "' was encountered after substring '";
+        message += GetGlyph(UString{ source, 0, position }) + "'";
+        ThrowInvalidRegex(message);
+    }
+
+    void Regexp::ThrowInvalidRegexRange(const size_t position, const UString& range) const
+    {
+        std::string message{ "Invalid range '" };
+        message += GetGlyph(range);
+        message += "' was encountered after substring '";
+        message += GetGlyph(UString{ source, 0, position - range.size() }) + "'";
+        ThrowInvalidRegex(message);
+    }
+
+    void Regexp::ThrowInvalidRegexEscape(const size_t position, const UString& escapeSequence) const
+    {
+        std::string message{ "Invalid escape sequence '" };
+        message += GetGlyph(escapeSequence);
+        message += "' was encountered after substring '";
+        if (position > source.size()) {
+            message += GetGlyph(UString{ source, 0, source.size() - escapeSequence.size() }) + "'";
+        }
+        else {
+            message += GetGlyph(UString{ source, 0, position - escapeSequence.size() }) + "'";
+        }
+        ThrowInvalidRegex(message);
+    }
+
+    void Regexp::ThrowInvalidRegex(const std::string& message) const
+    {
+        std::string fullMessage{ message };
+        fullMessage += ". Regular expression: ";
+        fullMessage += GetGlyph(source);
+        throw Error::InvalidRegex{ fullMessage };
+    }
+
+    void Regexp::ThrowCompileLimitExceeded(const std::string& message) const
+    {
+        std::string fullMessage{ "Compile limit exceeded. " };
+        fullMessage += message;
+        fullMessage += ". Regular expression: ";
+        fullMessage += GetGlyph(source);
+        throw Error::CompileLimitExceeded{ fullMessage };
+    }
+
+    void Regexp::CheckNFANodes(const size_t nNodes) const
+    {
+        if (options.maxNFANodes != 0 && nNodes > options.maxNFANodes) {
+            ThrowCompileLimitExceeded("The NFA has more than " + std::to_string(options.maxNFANodes) + " nodes");
+        }
+    }
+
+    void Regexp::CheckDFAStates(const size_t nStates) const
+    {
+        if (options.maxDFAStates != 0 && nStates > options.maxDFAStates) {
+            ThrowCompileLimitExceeded("The DFA has more than " + std::to_string(options.maxDFAStates) + " states");
+        }
+    }
+
+    void Regexp::CheckTime() const
+    {
+        if (options.maxTime != 0 && std::chrono::steady_clock::now() > deadline) {
+            ThrowCompileLimitExceeded("The compilation takes more than " + std::to_string(options.maxTime) + " ms");
+        }
+    }
+
+    // 'flags', 'cacheSize' and 'compileOptions' are kept by PutRE
+    Regexp::Regexp(const UString& string, const RegexpFlags flags, const size_t cacheSize,
+        const CompileOptions& compileOptions)
+        : source{ string }, ts{ source }, nfa{ Constants::notCharacter },
+        newLines{ { CharacterRange{ CTRL_LF, CTRL_LF }, CharacterRange{ CTRL_CR, CTRL_CR },
+            CharacterRange{ CTRL_LS, CTRL_PS } } },
+        reverseReady{ false }, utf8ReverseReady{ false }, fl{ flags }, cacheSize{ cacheSize }, options{ compileOptions }
+    {
+        if (string.size() == 0) {
+            throw Error::InvalidRegex{ "Empty regular expression " };
+        }
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.maxTime);
+        MakeDFA();
+    }
+
+    // the DFA of a RegexSet or a Scanner, only 'table' is created
+    Regexp::Regexp(const std::vector<UString>& patterns, const bool unanchored, const CompileOptions& compileOptions)
+        : ts{ source }, nfa{ Constants::notCharacter },
+        newLines{ { CharacterRange{ CTRL_LF, CTRL_LF }, CharacterRange{ CTRL_CR, CTRL_CR },
+            CharacterRange{ CTRL_LS, CTRL_PS } } },
+        reverseReady{ false }, utf8ReverseReady{ false }, fl{ REGFL_NOFLAGS }, cacheSize{ Constants::lazyCacheSize },
+        options{ compileOptions }
+    {
+        if (patterns.size() == 0) {
+            throw Error::InvalidRegex{ "Empty set of regular expressions " };
+        }
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.maxTime);
+        MakeSetDFA(patterns, unanchored);
+    }
+
+    // in the lazy mode the states are created in a temporary cache
+    bool Regexp::Match(const UString& string) const
+    {
+        LazyCache cache;
+        return Match(string, cache);
+    }
+
+    // 'cache' keeps the states of the lazy DFA between the calls, it is not used by the other modes
+    bool Regexp::Match(const UString& string, LazyCache& cache) const
+    {
+        if (!literal.Empty()) {
+            return string == literal.Literal();
+        }
+        if (!keywords.Empty()) {
+            return keywords.Match(string.data(), string.data() + string.size());
+        }
+        if (!lazy.Empty()) {
+            lazy.Prepare(cache);
+            StateIndex cur = LazyDFA::start;
+            for (const Character ch : string) {
+                cur = lazy.Forward(cache, cur, ch);
+                if (cur == LazyDFA::dead) {
+                    return false;
+                }
+            }
+            return lazy.IsAccept(cache, cur);
+        }
+        StateIndex cur = table.Start();
+        size_t pos = 0;
+        while (pos < string.size()) {
+            cur = table.Next(cur, string[pos]);
+            if (cur == DenseDFA::dead) {
+                return false;
+            }
+            ++pos;
+        }
+        return table.IsAccept(cur);
+    }
+
+    // the reverse DFAs are created by the first search that needs them, so the regular expressions that are
+    // only matched do not pay for them; if 'reverse' is too large, the searches use the states of the lazy DFA
+    // 'fallback' instead
+    const ReverseDFA& Regexp::Reverse() const
+    {
+        if (!reverseReady.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock{ reverseMutex };
+            if (!reverseReady.load(std::memory_order_relaxed)) {
+                reverse = CreateReverseDFA(table);
+                reverseReady.store(true, std::memory_order_release);
+            }
+        }
+        return reverse;
+    }
+
+    // if 'utf8Reverse' is too large, the UTF-8 text is decoded and searched as the UString
+    const ReverseDFA& Regexp::Utf8Reverse() const
+    {
+        if (!utf8ReverseReady.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock{ reverseMutex };
+            if (!utf8ReverseReady.load(std::memory_order_relaxed)) {
+                utf8Reverse = CreateReverseDFA(utf8Table);
+                utf8ReverseReady.store(true, std::memory_order_release);
+            }
+        }
+        return utf8Reverse;
+    }
+
+    // the text is read backwards once to find for every position the states of 'forward' that can still
+    // reach an accept state, so the leftmost match start is the first position where the start state is such
+    // a state and the longest match ends at the last accept state before the next state stops being such,
+    // so each character is read once backwards and at most once forwards;
+    // the function finds the runs of [first, last) of 'text' with 'forward' and its reverse DFA 'backward',
+    // the characters around it must not be a part of a match; the pass ends at the first position before 'stop'
+    // where 'backward' is idle, so the runs that end before 'stop' are only found if 'stop' is 'first'
+    template<class CharT>
+    void Regexp::FindLiveRuns(
+        const DenseDFA& forward,
+        const ReverseDFA& backward,
+        const CharT* text,
+        const size_t first,
+        const size_t last,
+        const size_t stop,
+        SearchState& state) const
+    {
+        std::vector<StateIndex>& states = state.states;
+        std::vector<SearchState::LiveRun>& runs = state.runs;
+        states.clear();
+        runs.clear();
+        const StateIndex idle = backward.Start();
+        StateIndex cur = idle;
+        size_t i = last;
+        while (i > first) {
+            if (cur == idle && !backward.Wake().Contains(text[i - 1])) {
+                // 'backward' stays in its start state until it reads one of the 'wake' characters
+                const CharT* p = (i > stop) ? backward.Wake().FindLast(text + stop, text + i) : nullptr;
+                if (p == nullptr) {
+                    break;
+                }
+                i = p - text + 1;
+            }
+            cur = backward.Next(cur, forward.Class(text[--i]));
+            const bool inRun = runs.size() > 0 && runs.back().first == i + 1;
+            // the start state is kept in the run if the next character wakes 'backward' again, so the runs are not
+            // split at each character of the UTF-8 text whose bytes are the 'wake' characters
+            if (cur == idle && (!inRun || i == first || !backward.Wake().Contains(text[i - 1]))) {
+                continue;
+            }
+            if (inRun) {
+                runs.back().first = i;
+            }
+            else {
+                runs.push_back(SearchState::LiveRun{ i, i, states.size() });
+            }
+            states.push_back(cur);
+        }
+        std::reverse(runs.begin(), runs.end());
+        state.rangeLast = last;
+        state.begin = first;
+        state.run = 0;
+    }
+
+    // the function finds the next match in the runs found by FindLiveRuns, it returns false if there is none
+    template<class CharT>
+    bool Regexp::NextInRuns(
+        const DenseDFA& forward,
+        const ReverseDFA& backward,
+        const CharT* text,
+        SearchState& state,
+        size_t& begin,
+        size_t& end) const
+    {
+        const std::vector<StateIndex>& states = state.states;
+        const std::vector<SearchState::LiveRun>& runs = state.runs;
+        const size_t last = state.rangeLast;
+        const StateIndex idle = backward.Start();
+        size_t run = state.run;
+        begin = state.begin;
+        while (run < runs.size() && runs[run].last < begin) {
+            ++run;
+        }
+        for (; run < runs.size(); ++run) {
+            begin = std::max(begin, runs[run].first);
+            const SearchState::LiveRun& r = runs[run];
+            while (begin <= r.last && !backward.IsLive(states[r.offset + r.last - begin], forward.Start())) {
+                ++begin;
+            }
+            if (begin <= r.last) {
+                break;
+            }
+        }
+        state.run = run;
+        if (run == runs.size()) {
+            state.begin = last;
+            return false;
+        }
+        end = begin;
+        StateIndex cur = forward.Start();
+        size_t k = run;                     // the first run that does not end before 'i + 1'
+        for (size_t i = begin; i < last; ++i) {
+            const StateIndex next = forward.Next(cur, text[i]);
+            while (k < runs.size() && runs[k].last < i + 1) {
+                ++k;
+            }
+            const StateIndex live = (k < runs.size() && runs[k].first <= i + 1)
+                ? states[runs[k].offset + runs[k].last - (i + 1)] : idle;
+            if (!backward.IsLive(live, next)) {
+                break;
+            }
+            cur = next;
+            if (forward.IsAccept(cur)) {
+                end = i + 1;
+            }
+        }
+        state.begin = end;
+        return true;
+    }
+
+    // the function searches [first, last) of 'text', the characters around it must not be a part of a match;
+    // 'report(begin, end)' is called for each match
+    template<class CharT, class Report>
+    void Regexp::ScanRange(
+        const DenseDFA& forward,
+        const ReverseDFA& backward,
+        const CharT* text,
+        const size_t first,
+        const size_t last,
+        Report report) const
+    {
+        SearchState state{ first, last };
+        FindLiveRuns(forward, backward, text, first, last, first, state);
+        size_t begin = 0;
+        size_t end = 0;
+        while (NextInRuns(forward, backward, text, state, begin, end)) {
+            report(begin, end);
+        }
+    }
+
+    // the same search as ScanRange with the states of SearchLazy(): the text is read backwards once to store
+    // the backward state at the end of every block of 'lazy.BlockSize()' characters, then the backward states
+    // of a block are found again from the stored one when the forward search reaches the block,
+    // so the backward states of only one block are kept and the cache is not cleared while they are used;
+    // the function searches [state.first, state.last), the characters around it must not be a part of a match
+    void Regexp::PrepareLazy(const UString& string, SearchState& state, LazyCache& cache) const
+    {
+        const LazyDFA& lazy = SearchLazy();
+        lazy.Prepare(cache);
+        const char32_t* text = string.data() + state.first;
+        const size_t n = state.last - state.first;
+        const size_t blockSize = lazy.BlockSize();
+        state.ends.assign(n / blockSize + 1, StateSet{});
+        StateIndex cur = LazyDFA::dead;
+        for (size_t i = n; i > 0; --i) {
+            if (i % blockSize == 0) {
+                state.ends[i / blockSize] = lazy.BackwardSet(cache, cur);
+            }
+            cur = lazy.Backward(cache, cur, text[i - 1]);
+        }
+        state.block.clear();
+        state.searched = state.last;
+    }
+
+    // the function returns the backward state at 'i' of 'text', the text of the search from 'state.first',
+    // the positions increase between the calls
+    StateIndex Regexp::LazyLive(const char32_t* text, const size_t i, SearchState& state, LazyCache& cache) const
+    {
+        const size_t n = state.last - state.first;
+        if (i == n) {
+            return LazyDFA::dead;
+        }
+        std::vector<StateIndex>& block = state.block;
+        if (block.size() == 0 || i > state.blockLast) {
+            const LazyDFA& lazy = SearchLazy();
+            const size_t blockSize = lazy.BlockSize();
+            state.blockFirst = i - i % blockSize;
+            state.blockLast = std::min(state.blockFirst + blockSize, n);
+            block.resize(state.blockLast - state.blockFirst + 1);
+            block.back() = lazy.BackwardState(cache,
+                (state.blockLast == n) ? StateSet{} : state.ends[state.blockLast / blockSize], block.size() + 1);
+            for (size_t k = state.blockLast; k > state.blockFirst; --k) {
+                block[k - 1 - state.blockFirst] = lazy.Backward(cache, block[k - state.blockFirst], text[k - 1]);
+            }
+        }
+        return block[i - state.blockFirst];
+    }
+
+    bool Regexp::NextLazy(const UString& string, SearchState& state, LazyCache& cache, size_t& begin, size_t& end) const
+    {
+        const LazyDFA& lazy = SearchLazy();
+        const char32_t* text = string.data() + state.first;
+        const size_t n = state.last - state.first;
+        size_t b = state.begin - state.first;
+        while (b < n && !lazy.IsLive(cache, LazyDFA::start, LazyLive(text, b, state, cache))) {
+            ++b;
+        }
+        if (b == n) {
+            state.begin = state.last;
+            return false;
+        }
+        size_t e = b;
+        StateIndex cur = LazyDFA::start;
+        for (size_t i = b; i < n; ++i) {
+            const StateIndex next = lazy.Forward(cache, cur, text[i]);
+            if (!lazy.IsLive(cache, next, LazyLive(text, i + 1, state, cache))) {
+                break;
+            }
+            cur = next;
+            if (lazy.IsAccept(cache, cur)) {
+                e = i + 1;
+            }
+        }
+        begin = state.first + b;
+        end = state.first + e;
+        state.begin = end;
+        return true;
+    }
+
+    // the function finds the next match in [state.first, state.last), it returns false if there is none;
+    // the character at 'state.last' must not be a part of a match;
+    // if the regular expression has a required literal, only the parts of the text around its occurrences
+    // that do not contain characters of class 0 (they cannot be a part of a match) are searched
+    bool Regexp::NextMatch(const UString& string, SearchState& state, LazyCache& cache, size_t& begin, size_t& end) const
+    {
+        const char32_t* text = string.data();
+        if (!literal.Empty()) {
+            const char32_t* p = literal.Find(text + state.begin, text + state.last);
+            if (p == nullptr) {
+                state.begin = state.last;
+                return false;
+            }
+            begin = p - text;
+            end = begin + literal.Literal().size();
+            state.begin = end;
+            return true;
+        }
+        if (!keywords.Empty()) {
+            const std::pair<const char32_t*, const char32_t*> p = keywords.Find(text + state.begin, text + state.last);
+            if (p.first == nullptr) {
+                state.begin = state.last;
+                return false;
+            }
+            begin = p.first - text;
+            end = p.second - text;
+            state.begin = end;
+            return true;
+        }
+        const ReverseDFA& backward = lazy.Empty() ? Reverse() : reverse;
+        if (!lazy.Empty() || backward.Size() == 0) {
+            if (state.searched != state.last) {
+                PrepareLazy(string, state, cache);
+            }
+            return NextLazy(string, state, cache, begin, end);
+        }
+        while (!NextInRuns(table, backward, text, state, begin, end)) {
+            if (state.searched == state.last) {
+                return false;
+            }
+            size_t first = state.searched;  // the part of the next runs
+            size_t last = state.last;
+            if (!prefilter.Empty() && !NextPrefilterRange(text, state.searched, state.last, first, last)) {
+                state.searched = state.last;
+                return false;
+            }
+            FindLiveRuns(table, backward, text, first, last, first, state);
+            state.searched = last;
+        }
+        return true;
+    }
+
+    // the function finds [first, end), the characters that are not of class 0 around the next occurrence
+    // of the literal of the prefilter in [searched, last), so the matches in [searched, last) are in such parts;
+    // it returns false if there is no occurrence
+    bool Regexp::NextPrefilterRange(const char32_t* text, const size_t searched, const size_t last,
+        size_t& first, size_t& end) const
+    {
+        const char32_t* p = prefilter.Find(text + searched, text + last);
+        if (p == nullptr) {
+            return false;
+        }
+        first = p - text;
+        end = first + prefilter.Literal().size();
+        while (first > searched && table.Class(text[first - 1]) != 0) {
+            --first;
+        }
+        while (end < last && table.Class(text[end]) != 0) {
+            ++end;
+        }
+        return true;
+    }
+
+    // the states of 'table' reached from all the positions of [first, last) are kept at once without repeats,
+    // a few states are searched for the repeats, 'marks' is allocated for more of them: 'marks[s]' is 'i + 1'
+    // if the state 's' has been reached at position 'i'; the function returns the end of the match that ends
+    // first or UString::npos
+    size_t Regexp::EarliestEndInRange(
+        const char32_t* text,
+        const size_t first,
+        const size_t last,
+        std::vector<StateIndex>& states,
+        std::vector<StateIndex>& next,
+        std::vector<size_t>& marks) const
+    {
+        constexpr size_t maxScannedStates = 16;
+        const StateIndex start = table.Start();
+        states.clear();
+        for (size_t i = first; i < last; ++i) {
+            if (states.size() == 0) {
+                // only the start state leaves the dead state, a match cannot begin at the characters it skips
+                while (i < last && table.Next(start, text[i]) == DenseDFA::dead) {
+                    ++i;
+                }
+                if (i == last) {
                     break;
                 }
-                try {
-                    a.ClosureCustom(min, max, type);
+            }
+            states.push_back(start);
+            next.clear();
+            for (const StateIndex state : states) {
+                const StateIndex target = table.Next(state, text[i]);
+                if (target == DenseDFA::dead) {
+                    continue;
                 }
-                catch (const Error::InvalidRegex& e) {
-                    ThrowInvalidRegex(e.what());
+                if ((marks.size() == 0) ? std::find(next.begin(), next.end(), target) != next.end()
+                    : marks[target] == i + 1)
+                {
+                    continue;
+                }
+                if (table.IsAccept(target)) {
+                    return i + 1;
+                }
+                next.push_back(target);
+                if (marks.size() != 0) {
+                    marks[target] = i + 1;
+                }
+                else if (next.size() > maxScannedStates) {
+                    marks.assign(table.Size(), 0);
+                    for (const StateIndex s : next) {
+                        marks[s] = i + 1;
+                    }
                 }
-                NextToken();
-                return;
             }
-            case SPEC_LPAR:
-            case SPEC_RPAR:
-            case SPEC_DOT:
-            case SPEC_LBRACKET:
-            case SPEC_BSLASH:
-            case SPEC_BAR:
-                return;
-            default:
-                break;
+            states.swap(next);
+        }
+        return UString::npos;
+    }
+
+    // the function calls 'visit' for each match in [first, last) until it returns false, the lines and
+    // the positions are counted from 'first'; it returns false if 'visit' has stopped the search
+    template<class Visit>
+    bool Regexp::SearchChunk(
+        const UString& string,
+        const size_t first,
+        const size_t last,
+        LazyCache& cache,
+        Visit visit) const
+    {
+        size_t line = 1;                    // line number
+        size_t pos = 1;                     // position in line
+        UString::const_iterator iter = string.cbegin() + first;
+        SearchState state{ first, last };
+        size_t begin = 0;
+        size_t end = 0;
+        while (NextMatch(string, state, cache, begin, end)) {
+            AdjustPositions(iter, string.cbegin() + begin, line, pos);
+            const MatchResults mr{ line, pos, string.cbegin() + begin, string.cbegin() + end };
+            iter = mr.str.second;
+            AdjustPositions(mr.str.first, iter, line, pos);
+            if (!visit(mr)) {
+                return false;
             }
-            break;
-        case Regexp::TokenStream::TokenType::LITERAL:
-            return;
-        default:
-            break;
         }
-        ThrowInvalidRegexCharacter(ts.GetPosition());
+        return true;
+    }
+
+    // the function returns true if no match contains the character
+    bool Regexp::IsSeparator(const Character ch) const
+    {
+        if (!literal.Empty()) {
+            return literal.Literal().find(ch) == UString::npos;
+        }
+        if (!keywords.Empty()) {
+            return keywords.Class(ch) == 0;
+        }
+        if (!lazy.Empty()) {
+            return lazy.Class(ch) == 0;
+        }
+        return table.Class(ch) == 0;
+    }
+
+    // in the lazy mode the states are created in a temporary cache
+    std::vector<MatchResults> Regexp::Search(const UString& string) const
+    {
+        LazyCache cache;
+        return Search(string, cache);
+    }
+
+    std::vector<MatchResults> Regexp::Search(const UString& string, LazyCache& cache) const
+    {
+        std::vector<MatchResults> results;
+        SearchChunk(string, 0, string.size(), cache, [&](const MatchResults& mr) {
+            results.push_back(mr);
+            return true;
+        });
+        return results;
+    }
+
+    // 'visit' is called for each match as soon as it is found, the search stops when it returns false;
+    // the function returns false if the search has been stopped
+    bool Regexp::Search(const UString& string, const std::function<bool(const MatchResults&)>& visit) const
+    {
+        LazyCache cache;
+        return SearchChunk(string, 0, string.size(), cache, visit);
+    }
+
+    MatchRange Regexp::Matches(const UString& string) const
+    {
+        return MatchRange{ *this, string };
+    }
+
+    // the queries below do not count the lines and the positions;
+    // in the lazy mode the states are created in a temporary cache
+    bool Regexp::Contains(const UString& string) const
+    {
+        LazyCache cache;
+        return Contains(string, cache);
+    }
+
+    // in the lazy mode the text is read until the first match ends; otherwise a match begins at a position
+    // if the backward pass of Search finds there a state from which the start state of 'table' is live,
+    // so the automaton does not run forwards
+    bool Regexp::Contains(const UString& string, LazyCache& cache) const
+    {
+        const char32_t* text = string.data();
+        const size_t n = string.size();
+        if (!literal.Empty()) {
+            return literal.Find(text, text + n) != nullptr;
+        }
+        if (!keywords.Empty()) {
+            return keywords.FindEnd(text, text + n) != nullptr;
+        }
+        const ReverseDFA& backward = lazy.Empty() ? Reverse() : reverse;
+        if (!lazy.Empty() || backward.Size() == 0) {
+            return EarliestMatchEnd(string, cache) != UString::npos;
+        }
+        const StateIndex start = table.Start();
+        return SearchWindows(text, n, backward, [&](const SearchState& state) {
+            return std::any_of(state.states.begin(), state.states.end(), [&](const StateIndex s) {
+                return backward.IsLive(s, start);
+            });
+        });
+    }
+
+    MatchResults::Matched Regexp::FindFirst(const UString& string) const
+    {
+        LazyCache cache;
+        return FindFirst(string, cache);
+    }
+
+    // the function returns the first match of Search or { string.cend(), string.cend() }
+    MatchResults::Matched Regexp::FindFirst(const UString& string, LazyCache& cache) const
+    {
+        SearchState state{ 0, string.size() };
+        size_t begin = 0;
+        size_t end = 0;
+        if (!NextMatch(string, state, cache, begin, end)) {
+            return MatchResults::Matched{ string.cend(), string.cend() };
+        }
+        return MatchResults::Matched{ string.cbegin() + begin, string.cbegin() + end };
+    }
+
+    size_t Regexp::Count(const UString& string) const
+    {
+        LazyCache cache;
+        return Count(string, cache);
+    }
+
+    // the function returns the number of the matches of Search
+    size_t Regexp::Count(const UString& string, LazyCache& cache) const
+    {
+        SearchState state{ 0, string.size() };
+        size_t count = 0;
+        size_t begin = 0;
+        size_t end = 0;
+        while (NextMatch(string, state, cache, begin, end)) {
+            ++count;
+        }
+        return count;
+    }
+
+    size_t Regexp::EarliestMatchEnd(const UString& string) const
+    {
+        LazyCache cache;
+        return EarliestMatchEnd(string, cache);
+    }
+
+    // the function returns the least end of a match or UString::npos if there is no match; a match may begin
+    // at any position, so the automaton runs from all the positions at once, in the lazy mode the text is read
+    // forwards up to that end only; otherwise the backward pass of Search finds the runs of the positions
+    // where a match may be, as in NextMatch, and the automaton only runs through them: the match that ends
+    // first has no accept state before its end, so it lies inside one run; the backward pass reads windows
+    // of growing size, the runs of a window only hold the matches that end in it, and the pass over a window
+    // ends below the previous one once 'backward' is idle, since the matches that end there have been searched
+    size_t Regexp::EarliestMatchEnd(const UString& string, LazyCache& cache) const
+    {
+        const char32_t* text = string.data();
+        const size_t n = string.size();
+        if (!literal.Empty()) {
+            const char32_t* p = literal.Find(text, text + n);
+            return (p == nullptr) ? UString::npos : p - text + literal.Literal().size();
+        }
+        if (!keywords.Empty()) {
+            const char32_t* p = keywords.FindEnd(text, text + n);
+            return (p == nullptr) ? UString::npos : p - text;
+        }
+        const ReverseDFA& backward = lazy.Empty() ? Reverse() : reverse;
+        if (!lazy.Empty() || backward.Size() == 0) {
+            const LazyDFA& lazy = SearchLazy();
+            lazy.Prepare(cache);
+            StateIndex cur = LazyDFA::start;
+            for (size_t i = 0; i < n; ++i) {
+                cur = lazy.ForwardUnanchored(cache, cur, text[i]);
+                if (lazy.IsAcceptUnanchored(cache, cur)) {
+                    return i + 1;
+                }
+            }
+            return UString::npos;
+        }
+        std::vector<StateIndex> states;
+        std::vector<StateIndex> next;
+        std::vector<size_t> marks;
+        size_t end = UString::npos;
+        SearchWindows(text, n, backward, [&](const SearchState& state) {
+            for (const SearchState::LiveRun& run : state.runs) {
+                end = EarliestEndInRange(text, run.first, run.last + 1, states, next, marks);
+                if (end != UString::npos) {
+                    return true;
+                }
+            }
+            return false;
+        });
+        return end;
+    }
+
+    // the function reads the text backwards with FindLiveRuns in windows of growing size, as described above,
+    // and calls 'found(state)' with the runs of each window until it returns true; it returns false if it does not
+    template<class Found>
+    bool Regexp::SearchWindows(const char32_t* text, const size_t n, const ReverseDFA& backward, Found found) const
+    {
+        constexpr size_t firstWindow = 4096;
+        SearchState state{ 0, n };
+        size_t searched = 0;                // end of the last searched part
+        size_t first = 0;
+        size_t last = n;
+        while (searched < n) {
+            if (!prefilter.Empty() && !NextPrefilterRange(text, searched, n, first, last)) {
+                return false;
+            }
+            size_t window = firstWindow;
+            for (size_t done = first; done < last; done += window, window *= 4) {
+                window = std::min(window, last - done);
+                FindLiveRuns(table, backward, text, first, done + window, done, state);
+                if (found(state)) {
+                    return true;
+                }
+            }
+            searched = last;
+        }
+        return false;
+    }
+
+    namespace
+    {
+        // the function decodes the UTF-8 sequence at 'p' to 'ch', it returns the length of the sequence
+        // or 0 if it is not valid
+        size_t DecodeUtf8Sequence(const unsigned char* p, const unsigned char* last, Character& ch)
+        {
+            const unsigned char lead = *p;
+            size_t length = (lead < 0x80) ? 1 : (lead < 0xC2) ? 0 : (lead < 0xE0) ? 2 : (lead < 0xF0) ? 3 : (lead < 0xF5) ? 4 : 0;
+            // the bounds of the second byte, they exclude the overlong sequences, the surrogates
+            // and the characters above 0x10FFFF
+            const unsigned char lo = (lead == 0xE0) ? 0xA0 : (lead == 0xF0) ? 0x90 : 0x80;
+            const unsigned char hi = (lead == 0xED) ? 0x9F : (lead == 0xF4) ? 0x8F : 0xBF;
+            if (length == 0 || length > static_cast<size_t>(last - p)) {
+                return 0;
+            }
+            for (size_t k = 1; k < length; ++k) {
+                if ((k == 1 && (p[k] < lo || p[k] > hi)) || (p[k] & 0xC0) != 0x80) {
+                    return 0;
+                }
+            }
+            ch = (length == 1) ? lead : lead & (0x7F >> length);
+            for (size_t k = 1; k < length; ++k) {
+                ch = (ch << 6) | (p[k] & 0x3F);
+            }
+            return length;
+        }
+    }
+
+    // the UTF-8 text is read by 'utf8Table' without decoding it, the regular expression must be compiled
+    // with REGFL_UTF8
+    bool Regexp::Match(const char* first, const char* last) const
+    {
+        const bool utf8 = FLAG_IS_SET(fl, REGFL_UTF8);
+        if (!utf8) {
+            throw Error::RuntimeError{ "Regexp::Match(): The regular expression is not compiled with REGFL_UTF8" };
+        }
+        StateIndex cur = utf8Table.Start();
+        for (const unsigned char* p = reinterpret_cast<const unsigned char*>(first);
+            p != reinterpret_cast<const unsigned char*>(last); ++p)
+        {
+            cur = utf8Table.Next(cur, *p);
+            if (cur == DenseDFA::dead) {
+                return false;
+            }
+        }
+        return utf8Table.IsAccept(cur);
+    }
+
+    // the same search as Search(const UString&) for the UTF-8 text, the bytes that are not a part of
+    // a valid UTF-8 sequence are not a part of a match
+    std::vector<Utf8MatchResults> Regexp::Search(const char* first, const char* last) const
+    {
+        const bool utf8 = FLAG_IS_SET(fl, REGFL_UTF8);
+        if (!utf8) {
+            throw Error::RuntimeError{ "Regexp::Search(): The regular expression is not compiled with REGFL_UTF8" };
+        }
+        const unsigned char* text = reinterpret_cast<const unsigned char*>(first);
+        std::vector<Utf8MatchResults> results;
+        size_t line = 1;                    // line number
+        size_t pos = 1;                     // position in line
+        size_t counted = 0;                 // end of the text where the positions are counted
+        auto report = [&](const size_t begin, const size_t end) {
+            AdjustPositions(text + counted, text + begin, line, pos);
+            results.push_back(Utf8MatchResults{ line, pos, begin, Utf8MatchResults::Matched{ first + begin, first + end } });
+            AdjustPositions(text + begin, text + end, line, pos);
+            counted = end;
+        };
+        const size_t size = last - first;
+        const ReverseDFA& backward = Utf8Reverse();
+        if (backward.Size() == 0) {
+            // the runs of the valid sequences are decoded and searched by NextMatch, 'offsets' holds
+            // the offset of each character of the run and the offset of its end
+            LazyCache cache;
+            UString string;
+            std::vector<size_t> offsets;
+            size_t i = 0;
+            while (i < size) {
+                string.clear();
+                offsets.clear();
+                Character ch = 0;
+                size_t length = 0;
+                while (i < size && (length = DecodeUtf8Sequence(text + i, text + size, ch)) != 0) {
+                    string.push_back(ch);
+                    offsets.push_back(i);
+                    i += length;
+                }
+                offsets.push_back(i);
+                SearchState state{ 0, string.size() };
+                size_t begin = 0;
+                size_t end = 0;
+                while (NextMatch(string, state, cache, begin, end)) {
+                    report(offsets[begin], offsets[end]);
+                }
+                ++i;                        // the invalid byte
+            }
+            return results;
+        }
+        if (prefilter.Empty()) {
+            ScanRange(utf8Table, backward, text, 0, size, report);
+            return results;
+        }
+        // the bytes of class 0 are not a part of a match, as the characters of class 0 in SearchChunk
+        size_t searched = 0;                // end of the last searched part
+        const unsigned char* p = nullptr;
+        while ((p = prefilter.Find(text + searched, text + size)) != nullptr) {
+            size_t begin = p - text;
+            size_t end = begin + prefilter.Bytes().size();
+            while (begin > searched && utf8Table.Class(text[begin - 1]) != 0) {
+                --begin;
+            }
+            while (end < size && utf8Table.Class(text[end]) != 0) {
+                ++end;
+            }
+            ScanRange(utf8Table, backward, text, begin, end, report);
+            searched = end;
+        }
+        return results;
+    }
+
+    // the text is split into chunks at the characters that cannot be a part of a match, so no match crosses
+    // the borders of the chunks and the matches of each chunk are the same as the ones found by Search;
+    // the chunks are searched by 'nThreads' threads (the number of hardware threads if it is 0),
+    // then the lines and the positions of the matches are shifted by the lines and the positions
+    // at the beginnings of their chunks; if the text has no such characters, it is searched by one thread
+    std::vector<MatchResults> Regexp::SearchParallel(const UString& string, const size_t nThreads) const
+    {
+        const size_t n = string.size();
+        const size_t nWorkers = std::max<size_t>(1, (nThreads == 0) ? std::thread::hardware_concurrency() : nThreads);
+        const size_t chunkSize = std::max(Constants::minChunkSize, n / (nWorkers * 4) + 1);
+        if (nWorkers == 1 || n <= chunkSize) {
+            return Search(string);
+        }
+        std::vector<size_t> borders{ 0 };   // chunk k is [borders[k], borders[k + 1])
+        for (size_t border = chunkSize; border < n; border += chunkSize) {
+            border = std::max(border, borders.back() + 1);
+            while (border < n && !IsSeparator(string[border])) {
+                ++border;
+            }
+            if (border < n) {
+                borders.push_back(border);
+            }
+        }
+        borders.push_back(n);
+        const size_t nChunks = borders.size() - 1;
+
+        struct Chunk {
+            std::vector<MatchResults> results;  // the lines and positions are counted from the chunk
+            size_t lines;                       // number of new lines in the chunk
+            size_t pos;                         // position in line after the chunk, counted from the chunk
+        };
+        std::vector<Chunk> chunks(nChunks);
+        std::atomic<size_t> next{ 0 };
+        std::vector<std::exception_ptr> errors(nWorkers);
+        auto work = [&](const size_t worker) {
+            try {
+                LazyCache cache;
+                for (size_t k = next++; k < nChunks; k = next++) {
+                    Chunk& chunk = chunks[k];
+                    SearchChunk(string, borders[k], borders[k + 1], cache, [&chunk](const MatchResults& mr) {
+                        chunk.results.push_back(mr);
+                        return true;
+                    });
+                    size_t line = 1;
+                    chunk.pos = 1;
+                    AdjustPositions(string.cbegin() + borders[k], string.cbegin() + borders[k + 1], line, chunk.pos);
+                    chunk.lines = line - 1;
+                }
+            }
+            catch (...) {
+                errors[worker] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t worker = 1; worker < std::min(nWorkers, nChunks); ++worker) {
+            threads.emplace_back(work, worker);
+        }
+        work(0);
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        for (const std::exception_ptr& e : errors) {
+            if (e) {
+                std::rethrow_exception(e);
+            }
+        }
+
+        std::vector<MatchResults> results;
+        size_t line = 1;                    // line number at the beginning of the chunk
+        size_t pos = 1;                     // position in line at the beginning of the chunk
+        for (Chunk& chunk : chunks) {
+            for (MatchResults& mr : chunk.results) {
+                if (mr.ln == 1) {
+                    mr.pos += pos - 1;
+                }
+                mr.ln += line - 1;
+                results.push_back(mr);
+            }
+            if (chunk.lines == 0) {
+                pos += chunk.pos - 1;
+            }
+            else {
+                line += chunk.lines;
+                pos = chunk.pos;
+            }
+        }
+        return results;
+    }
+
+    void Regexp::PutRE(const UString& string)
+    {
+        if (string.size() == 0) {
+            throw Error::InvalidRegex{ "Empty regular expression " };
+        }
+        source = string;
+        ts.Reset();
+        alphabetTemp = std::vector<CharacterRange>{};
+        alphabet = std::vector<CharacterRange>{};
+        nfa = NFA{ Constants::notCharacter };
+        dfa = DFA{};
+        table = DenseDFA{};
+        reverse = ReverseDFA{};
+        prefilter = Prefilter{};
+        literal = LiteralSearcher{};
+        keywords = AhoCorasick{};
+        lazy = LazyDFA{};
+        fallback = LazyDFA{};
+        utf8Table = DenseDFA{};
+        utf8Reverse = ReverseDFA{};
+        reverseReady = false;
+        utf8ReverseReady = false;
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.maxTime);
+        MakeDFA();
+    }
+
+    void Regexp::PutRE(const UString& string, const CompileOptions& compileOptions)
+    {
+        options = compileOptions;
+        PutRE(string);
+    }
+
+    // the function returns the approximate number of bytes used by the Regexp, the caches of the lazy DFA
+    // belong to the threads and are not counted, the reverse DFAs are counted once a search has created them
+    size_t Regexp::MemoryUsage() const
+    {
+        size_t reverses = 0;                // the reverse DFAs created by the searches
+        if (reverseReady.load(std::memory_order_acquire)) {
+            reverses += reverse.MemoryUsage();
+        }
+        if (utf8ReverseReady.load(std::memory_order_acquire)) {
+            reverses += utf8Reverse.MemoryUsage();
+        }
+        return sizeof(Regexp) + source.capacity() * sizeof(Character)
+            + (alphabetTemp.capacity() + alphabet.capacity()) * sizeof(CharacterRange)
+            + nfa.Size() * sizeof(NFAnode) + dfa.Size() * sizeof(DFAnode) + table.MemoryUsage() + reverses
+            + prefilter.MemoryUsage() + literal.MemoryUsage() + keywords.MemoryUsage() + lazy.MemoryUsage()
+            + fallback.MemoryUsage() + utf8Table.MemoryUsage() + acceptSets.capacity() * sizeof(std::vector<Index>);
+    }
+
+    bool operator==(const Regexp& left, const Regexp& right)
+    {
+        return (left.source == right.source && left.table == right.table && left.fl == right.fl);
+    }
+
+    bool operator!=(const Regexp& left, const Regexp& right)
+    {
+        return !(left == right);
+    }
+
+    ///----------------------------------------------------------------------------------------------------
+
+    MatchIterator::MatchIterator(const Regexp& regexp, const UString& string)
+        : re{ &regexp }, string{ &string }, state{ 0, string.size() }, iter{ string.cbegin() }, line{ 1 }, pos{ 1 },
+        current{ 0, 0, string.cbegin(), string.cbegin() }
+    {
+        ++*this;
+    }
+
+    // the iterator becomes the end after the last match
+    MatchIterator& MatchIterator::operator++()
+    {
+        size_t begin = 0;
+        size_t end = 0;
+        if (!re->NextMatch(*string, state, cache, begin, end)) {
+            *this = MatchIterator{};
+            return *this;
+        }
+        re->AdjustPositions(iter, string->cbegin() + begin, line, pos);
+        current = MatchResults{ line, pos, string->cbegin() + begin, string->cbegin() + end };
+        iter = current.str.second;
+        re->AdjustPositions(current.str.first, iter, line, pos);
+        return *this;
+    }
+
+    ///----------------------------------------------------------------------------------------------------
+
+    constexpr size_t StreamMatcher::maxScannedRuns;
+
+    StreamMatcher::StreamMatcher(const Regexp& regexp)
+        : re{ regexp }
+    {
+        Reset();
+    }
+
+    // the states of the literal are 1 + the number of its matched characters,
+    // the states of the strings are 1 + the states of their trie
+    StateIndex StreamMatcher::Start() const
+    {
+        if (!re.literal.Empty() || !re.keywords.Empty()) {
+            return 1;
+        }
+        if (!re.lazy.Empty()) {
+            return LazyDFA::start;
+        }
+        return re.table.Start();
     }
 
-    // parse Count
-    void Regexp::PCount(int& min, int& max, Constants::ClosureType& ty)
+    StateIndex StreamMatcher::Next(const StateIndex state, const Character ch) const
     {
-        switch (token.second) {
-        case Regexp::TokenStream::TokenType::EOS:
-            break;
-        case Regexp::TokenStream::TokenType::SPECIAL:
-            break;
-        case Regexp::TokenStream::TokenType::LITERAL:
-            if (isdigit(token.first)) {
-                min = PGetInteger();
-                ty = Constants::ClosureType::FINITE;
-                PCountMore(max, ty);
-                return;
-            }
-            break;
-        default:
-            break;
+        if (!re.literal.Empty()) {
+            const UString& literal = re.literal.Literal();
+            return (state <= literal.size() && literal[state - 1] == ch) ? state + 1 : 0;
         }
-        ThrowInvalidRegexCharacter(ts.GetPosition());
+        if (!re.keywords.Empty()) {
+            const StateIndex next = re.keywords.Goto(state - 1, re.keywords.Class(ch));
+            return (next == AhoCorasick::none) ? 0 : next + 1;
+        }
+        return re.table.Next(state, ch);
     }
 
-    // parse CountMore
-    void Regexp::PCountMore(int& max, Constants::ClosureType& ty)
+    bool StreamMatcher::IsAccept(const StateIndex state) const
     {
-        switch (token.second) {
-        case Regexp::TokenStream::TokenType::EOS:
-            return;
-        case Regexp::TokenStream::TokenType::SPECIAL:
-            switch (token.first) {
-            case SPEC_RBRACE:
-                return;
-            default:
-                break;
-            }
-            break;
-        case Regexp::TokenStream::TokenType::LITERAL:
-            switch (token.first) {
-            case LIT_COMMA:
-                ty = Constants::ClosureType::INFITITE;
-                NextToken();
-                PMax(max, ty);
-                return;
-            default:
-                break;
-            }
-            break;
-        default:
-            break;
+        if (!re.literal.Empty()) {
+            return state == re.literal.Literal().size() + 1;
         }
-        ThrowInvalidRegexCharacter(ts.GetPosition());
+        if (!re.keywords.Empty()) {
+            return re.keywords.IsString(state - 1);
+        }
+        if (!re.lazy.Empty()) {
+            return re.lazy.IsAccept(cache, state);
+        }
+        return re.table.IsAccept(state);
     }
 
-    // parse Max
-    void Regexp::PMax(int& max, Constants::ClosureType& ty)
+    // the function moves the runs on 'ch', removes the dead ones and joins the ones in the same state
+    void StreamMatcher::Step(const Character ch)
     {
-        switch (token.second) {
-        case Regexp::TokenStream::TokenType::EOS:
-            return;
-        case Regexp::TokenStream::TokenType::SPECIAL:
-            switch (token.first) {
-            case SPEC_RBRACE:
-                return;
-            default:
-                break;
+        ++steps;
+        if (!re.lazy.Empty()) {
+            states.clear();
+            for (const Run& run : runs) {
+                states.push_back(run.state);
             }
-            break;
-        case Regexp::TokenStream::TokenType::LITERAL:
-            if (isdigit(token.first)) {
-                max = PGetInteger();
-                ty = Constants::ClosureType::RANGE;
-                return;
+            re.lazy.Step(cache, states, ch);
+            for (size_t k = 0; k < runs.size(); ++k) {
+                runs[k].state = states[k];
             }
-            break;
-        default:
-            break;
         }
-        ThrowInvalidRegexCharacter(ts.GetPosition());
+        else {
+            for (Run& run : runs) {
+                run.state = Next(run.state, ch);
+            }
+        }
+        if (runs.size() <= maxScannedRuns) {
+            // the runs are sorted by 'first', so the earliest run of each state is kept
+            size_t n = 0;
+            for (size_t k = 0; k < runs.size(); ++k) {
+                const StateIndex state = runs[k].state;
+                if (state != 0 && std::none_of(runs.begin(), runs.begin() + n, [state](const Run& run) { return run.state == state; })) {
+                    runs[n++] = runs[k];
+                }
+            }
+            runs.resize(n);
+            return;
+        }
+        runs.erase(std::remove_if(runs.begin(), runs.end(), [](const Run& run) { return run.state == 0; }), runs.end());
+        if (runs.size() > 1) {
+            std::stable_sort(runs.begin(), runs.end(), [](const Run& a, const Run& b) { return a.state < b.state; });
+            runs.erase(std::unique(runs.begin(), runs.end(), [](const Run& a, const Run& b) { return a.state == b.state; }),
+                runs.end());
+            std::sort(runs.begin(), runs.end(), [](const Run& a, const Run& b) { return a.first < b.first; });
+        }
     }
 
-    // parse INTEGER
-    int Regexp::PGetInteger()
+    // the function reads the buffered characters from 'next', a new run begins at each character unless a run
+    // is in the start state; when a run reaches an accept state, its match replaces the pending match
+    // that it begins before or within, and the runs and the matches after it are dropped; a run in the same state
+    // as an earlier one reaches an accept state with it, so it is dropped too
+    void StreamMatcher::Read(std::vector<StreamMatch>& matches)
     {
-        std::string s;
-        while (isdigit(token.first)) {
-            s += token.first;
-            NextToken();
+        const StateIndex start = Start();
+        const size_t last = bufferFirst + buffer.size();
+        while (next < last) {
+            if (runs.size() == 0) {
+                // the characters on which the start state dies do not begin a run
+                if (!re.lazy.Empty()) {
+                    while (next < last && re.lazy.Forward(cache, start, buffer[next - bufferFirst]) == LazyDFA::dead) {
+                        ++next;
+                    }
+                }
+                else {
+                    while (next < last && Next(start, buffer[next - bufferFirst]) == 0) {
+                        ++next;
+                    }
+                }
+                if (next == last) {
+                    break;
+                }
+            }
+            if (std::none_of(runs.begin(), runs.end(), [start](const Run& run) { return run.state == start; })) {
+                runs.push_back(Run{ next, start });
+            }
+            Step(buffer[next - bufferFirst]);
+            ++next;
+            const std::vector<Run>::iterator accepted = std::find_if(runs.begin(), runs.end(),
+                [this](const Run& run) { return IsAccept(run.state); });
+            if (accepted != runs.end()) {
+                const size_t first = accepted->first;
+                runs.erase(accepted + 1, runs.end());
+                pending.erase(std::upper_bound(pending.begin() + reported, pending.end(), first,
+                    [](const size_t position, const Match& match) { return position < match.last; }), pending.end());
+                pending.push_back(Match{ first, next });
+            }
+            Report(matches);
         }
-        return atoi(s.c_str());
     }
 
-    void Regexp::ThrowInvalidRegexCharacter(const size_t position) const
+    // the function reports the pending matches that begin before all the runs, so no run can replace them
+    void StreamMatcher::Report(std::vector<StreamMatch>& matches)
     {
-        std::string message{ "Invalid character '" };
-        if (position < source.size()) {
-            message += GetGlyph(source[position]);
+        while (reported < pending.size() && (runs.size() == 0 || runs.front().first > pending[reported].first)) {
+            const Match& match = pending[reported++];
+            Count(match.first);
+            matches.push_back(StreamMatch{ line, pos, match.first,
+                buffer.substr(match.first - bufferFirst, match.last - match.first) });
+            Count(match.last);
         }
-        else {
-            message += Strings::eof;
+        if (reported == pending.size()) {
+            pending.clear();
+            reported = 0;
         }
-        message += "' was encountered after substring '";
-        message += GetGlyph(UString{ source, 0, position }) + "'";
-        ThrowInvalidRegex(message);
     }
 
-    void Regexp::ThrowInvalidRegexRange(const size_t position, const UString& range) const
+    // the function moves 'line' and 'pos' to 'position', the characters up to it must be in the buffer
+    void StreamMatcher::Count(const size_t position)
     {
-        std::string message{ "Invalid range '" };
-        message += GetGlyph(range);
-        message += "' was encountered after substring '";
-        message += GetGlyph(UString{ source, 0, position - range.size() }) + "'";
-        ThrowInvalidRegex(message);
+        re.AdjustPositions(buffer.cbegin() + (counted - bufferFirst), buffer.cbegin() + (position - bufferFirst),
+            line, pos);
+        counted = position;
     }
 
-    void Regexp::ThrowInvalidRegexEscape(const size_t position, const UString& escapeSequence) const
+    // the function returns the matches that are found in the stream after 'chunk' is added to it
+    std::vector<StreamMatch> StreamMatcher::Feed(const UString& chunk)
     {
-        std::string message{ "Invalid escape sequence '" };
-        message += GetGlyph(escapeSequence);
-        message += "' was encountered after substring '";
-        if (position > source.size()) {
-            message += GetGlyph(UString{ source, 0, source.size() - escapeSequence.size() }) + "'";
-        }
-        else {
-            message += GetGlyph(UString{ source, 0, position - escapeSequence.size() }) + "'";
+        std::vector<StreamMatch> matches;
+        buffer += chunk;
+        Read(matches);
+        size_t keep = (reported < pending.size()) ? pending[reported].first : next;
+        if (runs.size() > 0) {
+            keep = std::min(keep, runs.front().first);
         }
-        ThrowInvalidRegex(message);
+        Count(keep);
+        buffer.erase(0, keep - bufferFirst);
+        bufferFirst = keep;
+        return matches;
     }
 
-    void Regexp::ThrowInvalidRegex(const std::string& message) const
+    // the function returns the matches that are found at the end of the stream, the matcher is reset then;
+    // the runs end with the stream, so the pending matches are final
+    std::vector<StreamMatch> StreamMatcher::Finish()
     {
-        std::string fullMessage{ message };
-        fullMessage += ". Regular expression: ";
-        fullMessage += GetGlyph(source);
-        throw Error::InvalidRegex{ fullMessage };
+        std::vector<StreamMatch> matches;
+        Read(matches);
+        runs.clear();
+        Report(matches);
+        Reset();
+        return matches;
     }
 
-    Regexp::Regexp(const UString& string)
-        : source{ string }, ts{ source }, nfa{ Constants::notCharacter }, last{ Constants::notCharacter },
-        fl{ REGFL_NOFLAGS }
+    void StreamMatcher::Reset()
     {
-        if (string.size() == 0) {
-            throw Error::InvalidRegex{ "Empty regular expression " };
+        re.lazy.Prepare(cache);
+        buffer.clear();
+        bufferFirst = 0;
+        next = 0;
+        steps = 0;
+        runs.clear();
+        pending.clear();
+        reported = 0;
+        counted = 0;
+        line = 1;
+        pos = 1;
+    }
+
+    ///----------------------------------------------------------------------------------------------------
+
+    constexpr size_t RegexCache::defaultBudget;
+
+    size_t RegexCache::KeyHash::operator()(const Key& key) const
+    {
+        size_t h = std::hash<UString>{}(key.source);
+        for (const size_t v : { static_cast<size_t>(key.flags), key.cacheSize, key.options.maxNFANodes,
+            key.options.maxDFAStates, key.options.maxAlphabetSize, key.options.maxTime }) {
+            h ^= std::hash<size_t>{}(v) + 0x9E3779B9 + (h << 6) + (h >> 2);
         }
-        MakeDFA();
+        return h;
     }
 
-    bool Regexp::Match(const UString& string)
+    bool RegexCache::KeyEqual::operator()(const Key& left, const Key& right) const
     {
-        if (FLAG_IS_SET(fl, REGFL_NEGATED)) {
-            std::vector<DFAnode*>cur{ {dfa.first} };
-            size_t pos = 0;
-            while (pos < string.size()) {
-                cur = TakeStepThroughDFA(cur, string[pos]);
-                if (cur.size() == 0) {
-                    return false;
-                }
-                ++pos;
-            }
-            for (const DFAnode* p : cur) {
-                if (p->acc) {
-                    return true;
-                }
+        return (left.source == right.source && left.flags == right.flags && left.cacheSize == right.cacheSize
+            && left.options.maxNFANodes == right.options.maxNFANodes
+            && left.options.maxDFAStates == right.options.maxDFAStates
+            && left.options.maxAlphabetSize == right.options.maxAlphabetSize
+            && left.options.maxTime == right.options.maxTime);
+    }
+
+    RegexCache::RegexCache(const size_t budget)
+        : budget{ budget }, memory{ 0 }, clock{ 0 }, hits{ 0 }, misses{ 0 }, evictions{ 0 } {}
+
+    // a hit only reads the map and stores the time of the lookup in the entry, so the hits share the lock;
+    // on a miss the Regexp is compiled without the lock, if another thread has added the same Regexp meanwhile,
+    // its Regexp is returned; a Regexp larger than the budget is returned without being cached;
+    // an invalid regular expression throws the exceptions of the Regexp constructor
+    RegexCache::Handle RegexCache::Get(const UString& string, const RegexpFlags flags, const size_t cacheSize,
+        const CompileOptions& compileOptions)
+    {
+        Key key{ string, flags, cacheSize, compileOptions };
+        {
+            std::shared_lock<std::shared_timed_mutex> lock{ mutex };
+            auto it = entries.find(key);
+            if (it != entries.end()) {
+                it->second->lastUse.store(++clock, std::memory_order_relaxed);
+                ++hits;
+                return it->second->re;
             }
         }
-        else {
-            DFAnode* cur = dfa.first;
-            size_t pos = 0;
-            while (pos < string.size()) {
-                cur = TakeStepThroughDFA(cur, string[pos]);
-                if (cur == nullptr) {
-                    return false;
+        ++misses;
+        Handle re = std::make_shared<const Regexp>(string, flags, cacheSize, compileOptions);
+        const size_t size = re->MemoryUsage();
+        if (size > budget) {
+            return re;
+        }
+        std::unique_ptr<Entry> entry{ new Entry{ re, size, 0 } };
+        std::unique_lock<std::shared_timed_mutex> lock{ mutex };
+        auto result = entries.emplace(std::move(key), std::move(entry));
+        result.first->second->lastUse.store(++clock, std::memory_order_relaxed);
+        if (result.second == false) {
+            return result.first->second->re;
+        }
+        memory += size;
+        Evict(result.first->second.get());
+        return re;
+    }
+
+    // the function removes the least recently used entries other than 'keep' until the memory fits the budget,
+    // the caller holds the exclusive lock
+    void RegexCache::Evict(const Entry* keep)
+    {
+        while (memory > budget) {
+            auto victim = entries.end();
+            for (auto it = entries.begin(); it != entries.end(); ++it) {
+                if (it->second.get() != keep && (victim == entries.end()
+                    || it->second->lastUse.load(std::memory_order_relaxed)
+                    < victim->second->lastUse.load(std::memory_order_relaxed))) {
+                    victim = it;
                 }
-                ++pos;
             }
-            if (cur->acc) {
-                return true;
+            if (victim == entries.end()) {
+                return;
             }
+            memory -= victim->second->memory;
+            entries.erase(victim);
+            ++evictions;
         }
-        return false;
     }
 
-    std::vector<MatchResults> Regexp::Search(const UString& string)
+    void RegexCache::Clear()
     {
-        std::vector<MatchResults> results;
-        size_t line = 1;                    // line number
-        size_t pos = 1;                     // position in line
-        UString::const_iterator iter = string.cbegin();
-        if (FLAG_IS_SET(fl, REGFL_NEGATED)) {
-            while (iter != string.cend()) {
-                Character ch = *iter;
-                std::vector<DFAnode*> cur{ {dfa.first} };
-                cur = TakeStepThroughDFA(cur, ch);
-                if (cur.size() == 0) {
-                    AdjustPositions(iter, iter + 1, line, pos);
-                    ++iter;
-                    continue;
-                }
-                MatchResults mr{ line, pos, iter, iter };
-                while (cur.size() != 0) {
-                    for (DFAnode* p : cur) {
-                        if (p->acc) {
-                            mr.str.second = iter + 1;
-                            break;
-                        }
-                    }
-                    if (++iter == string.cend()) {
-                        break;
-                    }
-                    ch = *iter;
-                    cur = TakeStepThroughDFA(cur, ch);
-                }
-                if (mr.str.second == mr.str.first) {
-                    iter = mr.str.first + 1;
-                }
-                else {
-                    iter = mr.str.second;
-                    results.push_back(mr);
-                }
-                AdjustPositions(mr.str.first, iter, line, pos);
-            }
+        std::unique_lock<std::shared_timed_mutex> lock{ mutex };
+        entries.clear();
+        memory = 0;
+    }
+
+    RegexCache::Statistics RegexCache::GetStatistics() const
+    {
+        std::shared_lock<std::shared_timed_mutex> lock{ mutex };
+        return Statistics{ hits.load(), misses.load(), evictions.load(), entries.size(), memory };
+    }
+
+    RegexCache& RegexCache::Global()
+    {
+        static RegexCache cache;
+        return cache;
+    }
+
+    ///----------------------------------------------------------------------------------------------------
+
+    RegexSet::RegexSet(const std::vector<UString>& patterns, const CompileOptions& compileOptions)
+        : re{ patterns, true, compileOptions }, nPatterns{ patterns.size() } {}
+
+    // the function returns the sorted indexes of the patterns that have a match in the text
+    std::vector<Index> RegexSet::Matches(const UString& string) const
+    {
+        std::vector<Index> patterns;
+        for (const SetMatch& match : Search(string)) {
+            patterns.push_back(match.pattern);
         }
-        else {
-            while (iter != string.cend()) {
-                Character ch = *iter;
-                DFAnode* cur = TakeStepThroughDFA(dfa.first, ch);
-                if (cur == nullptr) {
-                    AdjustPositions(iter, iter + 1, line, pos);
-                    ++iter;
-                    continue;
-                }
-                MatchResults mr{ line, pos, iter, iter };
-                while (cur != nullptr) {
-                    if (cur->acc) {
-                        mr.str.second = iter + 1;
-                    }
-                    if (++iter == string.cend()) {
-                        break;
-                    }
-                    ch = *iter;
-                    cur = TakeStepThroughDFA(cur, ch);
-                }
-                if (mr.str.second == mr.str.first) {
-                    iter = mr.str.first + 1;
-                }
-                else {
-                    iter = mr.str.second;
-                    results.push_back(mr);
+        std::sort(patterns.begin(), patterns.end());
+        return patterns;
+    }
+
+    // the text is read once and the reading stops when all the patterns have been found, the matches are
+    // in the order of their ends; an accept state is looked at the first time it is reached only,
+    // since its patterns are found then
+    std::vector<SetMatch> RegexSet::Search(const UString& string) const
+    {
+        const DenseDFA& table = re.table;
+        std::vector<SetMatch> matches;
+        std::vector<bool> labels(re.acceptSets.size(), false);  // the labels whose patterns are found
+        std::vector<bool> found(nPatterns, false);
+        StateIndex cur = table.Start();
+        for (size_t i = 0; i < string.size() && matches.size() < nPatterns; ++i) {
+            cur = table.Next(cur, string[i]);
+            if (!table.IsAccept(cur) || labels[table.Label(cur)]) {
+                continue;
+            }
+            labels[table.Label(cur)] = true;
+            for (const Index pattern : re.acceptSets[table.Label(cur)]) {
+                if (!found[pattern]) {
+                    found[pattern] = true;
+                    matches.push_back(SetMatch{ pattern, i + 1 });
                 }
-                AdjustPositions(mr.str.first, iter, line, pos);
             }
         }
-        return results;
+        return matches;
     }
 
-    void Regexp::PutRE(const UString& string)
+    ///----------------------------------------------------------------------------------------------------
+
+    constexpr Index Scanner::error;
+
+    std::vector<UString> RulePatterns(const std::vector<ScannerRule>& rules)
     {
-        if (string.size() == 0) {
-            throw Error::InvalidRegex{ "Empty regular expression " };
+        std::vector<UString> patterns;
+        patterns.reserve(rules.size());
+        for (const ScannerRule& rule : rules) {
+            patterns.push_back(rule.pattern);
         }
-        source = string;
-        ts.Reset();
-        alphabetTemp = std::set<Character>{};
-        alphabet = std::vector<Character>{};
-        nfa = NFA{ Constants::notCharacter };
-        dfa = DFA{};
-        last = Constants::notCharacter;
-        fl = REGFL_NOFLAGS;
-        MakeDFA();
+        return patterns;
     }
 
-    bool operator==(const Regexp& left, const Regexp& right)
+    Scanner::Scanner(const std::vector<ScannerRule>& rules, const CompileOptions& compileOptions)
+        : re{ RulePatterns(rules), false, compileOptions }
     {
-        return (left.source == right.source && left.dfa == right.dfa && left.fl == right.fl);
+        tokens.reserve(re.acceptSets.size());
+        for (const std::vector<Index>& set : re.acceptSets) {
+            tokens.push_back(rules[set.front()].token);
+        }
     }
 
-    bool operator!=(const Regexp& left, const Regexp& right)
+    // maximal munch, 'Engineering a Compiler', K. Cooper, L. Torczon, 2.5.1: the DFA runs from the beginning
+    // of the token until it dies and the token ends at the last accept state; the pairs (state, position)
+    // read after the last accept state cannot reach an accept state, they are remembered, so a later token
+    // stops at them and the whole text is read in linear time
+    std::vector<Token> Scanner::Tokenize(const UString& string) const
     {
-        return !(left == right);
+        const DenseDFA& table = re.table;
+        const size_t nStates = table.Size();
+        std::vector<Token> result;
+        std::unordered_set<size_t> failed;  // pairs (state, position) as 'position * nStates + state'
+        std::vector<size_t> read;           // pairs read after the last accept state of the token
+        size_t offset = 0;
+        while (offset < string.size()) {
+            StateIndex cur = table.Start();
+            size_t end = offset;
+            Index id = error;
+            read.clear();
+            for (size_t i = offset;;) {
+                const size_t pair = i * nStates + cur;
+                if (failed.count(pair) > 0) {
+                    break;
+                }
+                if (table.IsAccept(cur)) {
+                    end = i;
+                    id = tokens[table.Label(cur)];
+                    read.clear();
+                }
+                else {
+                    read.push_back(pair);
+                }
+                if (i == string.size()) {
+                    break;
+                }
+                cur = table.Next(cur, string[i++]);
+                if (cur == DenseDFA::dead) {
+                    break;
+                }
+            }
+            failed.insert(read.begin(), read.end());
+            if (id == error) {
+                end = offset + 1;
+            }
+            result.push_back(Token{ id, offset, end - offset });
+            offset = end;
+        }
+        return result;
     }
 
+    ///----------------------------------------------------------------------------------------------------
+
     std::string GetGlyph(const Character ch, bool withQuotes)
     {
         const Character c = FLAGS_UNSET(ch, CHARFL_ALLFLAGS);
         std::string s;
-        if (FLAG_IS_SET(ch, CHARFL_NEGATED)) {
-            s += LIT_CARET;
-        }
         if (c >= ASCII_CTRL_MIN && c <= ASCII_CTRL_MAX) {
             return s + Strings::asciiCC[static_cast<unsigned int>(c)];
         }
@@ -1652,11 +4729,23 @@ namespace RE
                 oss << std::setw(Constants::unicodeDigits_6) << static_cast<unsigned int>(c);
                 s += "\\U";
             }
+            else {
+                oss << static_cast<unsigned int>(c);
+                s += "0x";
+            }
             s += oss.str();
             return s;
         }
     }
 
+    std::string GetGlyph(const CharacterRange& range, bool withQuotes)
+    {
+        if (range.first == range.second) {
+            return GetGlyph(range.first, withQuotes);
+        }
+        return GetGlyph(range.first, withQuotes) + static_cast<char>(LIT_HYPHEN) + GetGlyph(range.second, withQuotes);
+    }
+
     std::string GetGlyph(const UString& string)
     {
         std::string s;
@@ -1666,6 +4755,56 @@ namespace RE
         return s;
     }
 
+    // the function decodes the UTF-8 text, each byte that is not a part of a valid sequence is decoded
+    // as U+FFFD
+    UString DecodeUtf8(const std::string& string)
+    {
+        constexpr Character replacement = 0xFFFD;
+        UString result;
+        result.reserve(string.size());
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(string.data());
+        const unsigned char* const last = p + string.size();
+        while (p < last) {
+            Character ch = 0;
+            const size_t length = DecodeUtf8Sequence(p, last, ch);
+            if (length == 0) {
+                result.push_back(replacement);
+                ++p;
+                continue;
+            }
+            result.push_back(ch);
+            p += length;
+        }
+        return result;
+    }
+
+    std::string EncodeUtf8(const UString& string)
+    {
+        std::string result;
+        result.reserve(string.size());
+        for (const Character ch : string) {
+            if (ch < 0x80) {
+                result.push_back(static_cast<char>(ch));
+            }
+            else if (ch < 0x800) {
+                result.push_back(static_cast<char>(0xC0 | (ch >> 6)));
+                result.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+            }
+            else if (ch < 0x10000) {
+                result.push_back(static_cast<char>(0xE0 | (ch >> 12)));
+                result.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+                result.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+            }
+            else {
+                result.push_back(static_cast<char>(0xF0 | (ch >> 18)));
+                result.push_back(static_cast<char>(0x80 | ((ch >> 12) & 0x3F)));
+                result.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3F)));
+                result.push_back(static_cast<char>(0x80 | (ch & 0x3F)));
+            }
+        }
+        return result;
+    }
+
 #if REGEX_PRINT_FA_STATE
     void PrintNFA(std::ostream& os, const RE::Regexp& re)
     {
@@ -1696,7 +4835,7 @@ namespace RE
         const std::string to{ "->" };                           // transition mark
         const std::string ns{ "#" };                            // number sign
         const std::string eps{ "Epsilon" };                     // Epsilon mark
-        const size_t nLetters{ Constants::unicodeDigits_6 + 3 }; // number of letters
+        const size_t nLetters{ (Constants::unicodeDigits_6 + 3) * 2 + 1 }; // number of letters (range)
         const size_t cw1{ sp.size() + ((accept.size() > start.size()) ? accept.size() : start.size()) + sp.size() }; // column width 1
         const size_t cw2{ sizeof(NFAnode*) * 2 }; // column width 2
         const size_t cw3{ sp.size() + ns.size() + nDigits + sp.size() }; // column width 3
@@ -1731,7 +4870,7 @@ namespace RE
                     << sp << ns << std::setw(cw3 - sp.size() - ns.size()) << it->second << sep
                     << std::setw(cw4 + sep.size() + cw5) << sp << sep << std::endl;
                 std::ostringstream oss;
-                oss << sp << std::setw(nLetters) << GetGlyph(p->ch, true) << sp
+                oss << sp << std::setw(nLetters) << GetGlyph(CharacterRange{ p->ch, p->chLast }, true) << sp
                     << to << sp << ns << numbers.find(p->succ1)->second;
                 os << sep << std::setw(cw1 + sep.size() + cw2 + sep.size() + cw3) << sp
                     << sep << std::setw(cw4) << std::left << oss.str()
@@ -1759,6 +4898,26 @@ namespace RE
                 os << dl << std::endl;
                 break;
             }
+            case RE::NFAnode::Type::COUNTER: {
+                os << std::setw(cw2) << p << sep
+                    << sp << ns << std::setw(cw3 - sp.size() - ns.size()) << it->second << sep
+                    << std::setw(cw4 + sep.size() + cw5) << sp << sep << std::endl;
+                std::ostringstream count;
+                count << "{" << p->minCount << "," << ((p->maxCount < 0) ? "" : std::to_string(p->maxCount)) << "}";
+                std::ostringstream oss;
+                oss << sp << std::setw(nLetters) << count.str() << sp
+                    << to << sp << ns << numbers.find(p->succ2)->second;
+                os << sep << std::setw(cw1 + sep.size() + cw2 + sep.size() + cw3) << sp
+                    << sep << std::setw(cw4) << std::left << oss.str()
+                    << sep << p->succ2 << sep << std::endl;
+                std::ostringstream exit;
+                exit << sp << std::setw(nLetters) << eps << sp
+                    << to << sp << ns << numbers.find(p->succ1)->second;
+                os << sep << std::setw(cw1 + sep.size() + cw2 + sep.size() + cw3) << sp
+                    << sep << std::setw(cw4) << std::left << exit.str()
+                    << sep << p->succ1 << sep << std::endl << dl << std::endl;
+                break;
+            }
             case RE::NFAnode::Type::ACCEPT:
                 os << std::setw(cw2) << p << sep
                     << sp << ns << std::setw(cw3 - sp.size() - ns.size()) << it->second << sep
@@ -1799,7 +4958,7 @@ namespace RE
         const std::string start{ "START" };
         const std::string to{ "->" };                           // transition mark
         const std::string ns{ "#" };                            // number sign
-        const size_t nLetters{ Constants::unicodeDigits_6 + 3 }; // number of letters
+        const size_t nLetters{ (Constants::unicodeDigits_6 + 3) * 2 + 1 }; // number of letters (range)
         const size_t cw1{ sp.size() + ((accept.size() > start.size()) ? accept.size() : start.size()) + sp.size() }; // column width 1
         const size_t cw2{ sizeof(DFAnode*) * 2 }; // column width 2
         const size_t cw3{ sp.size() + ns.size() + nDigits + sp.size() }; // column width 3
@@ -86,20 +86,21 @@ namespace RE
     using Index = size_t;
     using Number = size_t;
     using CharacterFlags = Character;
+    using CharacterRange = std::pair<Character, Character>;     // [first, last]
 
     enum CharacterFlag : CharacterFlags {
         CHARFL_NOTCHAR  = 0x80000000,       // Character bit #32: not Character
-        CHARFL_NEGATED  = 0x40000000,       // Character bit #31: NEGATED LITERAL (any other than this)
         CHARFL_NOFLAGS  = 0x00000000,       // NO FLAGS
-        CHARFL_ALLFLAGS = CHARFL_NOTCHAR | CHARFL_NEGATED
+        CHARFL_ALLFLAGS = CHARFL_NOTCHAR
     };
 
     using RegexpFlags = unsigned int;
 
     enum RegexpFlag : RegexpFlags {
-        REGFL_NEGATED   = 0x80000000,       // uint bit #32: negated characters are present
         REGFL_NOFLAGS   = 0x00000000,       // NO FLAGS
-        REGFL_ALLFLAGS  = REGFL_NEGATED
+        REGFL_LAZYDFA   = 0x00000001,       // DFA states are created when the text reaches them
+        REGFL_UTF8      = 0x00000002,       // a byte-level DFA is also created to match UTF-8 text
+        REGFL_ALLFLAGS  = REGFL_LAZYDFA | REGFL_UTF8
     };
 
     namespace Constants
@@ -108,7 +109,14 @@ namespace RE
         constexpr int unicodeDigits_6 = 6;  // number of Unicode code point digits after '\U'
         constexpr int regexpNoFlags = FLAGS_SET(0, REGFL_NOFLAGS);
         constexpr Character notCharacter = FLAGS_SET('\0', CHARFL_NOTCHAR);
-        constexpr Character firstNegated = FLAGS_SET('\0', CHARFL_NEGATED);
+        constexpr Character maxCharacter = CHARFL_NOTCHAR - 1;  // negated characters are complemented up to it
+        constexpr int classBlockBits = 8;   // number of low-order character bits resolved by the second level of the class map
+        constexpr Character classBlockSize = 1 << classBlockBits;
+        constexpr Character classBlockMask = classBlockSize - 1;
+        constexpr size_t lazyCacheSize = 4096;      // default number of the states of each cache of the lazy DFA
+        constexpr size_t minLazyCacheSize = 16;
+        constexpr size_t minChunkSize = size_t{ 1 } << 16;   // minimum number of the characters of a chunk of SearchParallel
+        constexpr size_t maxReverseStates = 4096;   // a larger reverse DFA is replaced with the lazy DFA
 
         enum class ClosureType : unsigned char {
             NOTYPE,
@@ -133,50 +141,146 @@ namespace RE
     ///----------------------------------------------------------------------------------------------------
 
     class Regexp;
+    class MatchRange;
+
+    // storage of the nodes of one automaton, the nodes are placed one after another in chunks
+    // and are destroyed together with the arena, without walking the graph
+    template<class T>
+    class NodeArena {
+        struct Chunk {
+            T* data;
+            size_t size;                    // number of constructed nodes
+            size_t capacity;
+        };
+        std::vector<Chunk> chunks;
+        std::allocator<T> alloc;
+        static constexpr size_t minChunkSize = 16;
+        static constexpr size_t maxChunkSize = 4096;
+    private:
+        // nonconst members
+        void Release()
+        {
+            for (Chunk& c : chunks) {
+                for (size_t i = 0; i < c.size; ++i) {
+                    c.data[i].~T();
+                }
+                alloc.deallocate(c.data, c.capacity);
+            }
+            chunks.clear();
+        }
+    public:
+        NodeArena() {}
+        ~NodeArena() { Release(); }
+
+        NodeArena(const NodeArena& other) = delete;
+        NodeArena& operator=(const NodeArena& other) = delete;
+
+        NodeArena(NodeArena&& other)
+            : chunks{ std::move(other.chunks) }
+        {
+            other.chunks.clear();
+        }
+
+        NodeArena& operator=(NodeArena&& other)
+        {
+            if (this != &other) {
+                Release();
+                chunks = std::move(other.chunks);
+                other.chunks.clear();
+            }
+            return *this;
+        }
+
+        // nonconst members
+        template<class... Args>
+        T* Create(Args&&... args)
+        {
+            if (chunks.size() == 0 || chunks.back().size == chunks.back().capacity) {
+                const size_t capacity = (chunks.size() == 0) ? minChunkSize
+                    : std::min(chunks.back().capacity * 2, maxChunkSize);
+                chunks.reserve(chunks.size() + 1);
+                chunks.push_back(Chunk{ alloc.allocate(capacity), 0, capacity });
+            }
+            Chunk& c = chunks.back();
+            T* p = new(c.data + c.size) T(std::forward<Args>(args)...);
+            ++c.size;
+            return p;
+        }
+
+        // the function takes over the nodes of 'other', the last chunk of this arena stays the current one
+        void Splice(NodeArena& other)
+        {
+            if (chunks.size() == 0) {
+                chunks.swap(other.chunks);
+                return;
+            }
+            chunks.insert(chunks.end() - 1, other.chunks.begin(), other.chunks.end());
+            other.chunks.clear();
+        }
+    };
+
+    template<class T>
+    constexpr size_t NodeArena<T>::minChunkSize;
+
+    template<class T>
+    constexpr size_t NodeArena<T>::maxChunkSize;
+
+    ///----------------------------------------------------------------------------------------------------
 
     struct NFAnode {
     public:
         enum class Type : unsigned char {
             LITERAL,                        // character, letter, symbol
             ACCEPT,                         // Accept state
-            EPSILON                         // Epsilon transition
+            EPSILON,                        // Epsilon transition
+            COUNTER                         // counted repetition of the character class at 'succ2', exit at 'succ1'
         };
     public:
         NFAnode* succ1;                     // succsessor 1
         NFAnode* succ2;                     // succsessor 2
-        Character ch;                       // character
+        Character ch;                       // character, the first character of the range [ch, chLast]
+        Character chLast;                   // the last character of the range [ch, chLast]
+        int minCount;                       // bounds of the repetition of COUNTER,
+        int maxCount;                       // 'maxCount' is -1 if the repetition is unbounded
         Type ty;                            // type
-        bool mark;
-        static NFAnode* hint;
     public:
         NFAnode(Type type, Character character = Constants::notCharacter)
-            : succ1{ nullptr }, succ2{ nullptr }, ch{ character }, ty{ type }, mark{ false } {}
+            : succ1{ nullptr }, succ2{ nullptr }, ch{ character }, chLast{ character },
+            minCount{ 0 }, maxCount{ 0 }, ty{ type } {}
+
+        NFAnode(Type type, const CharacterRange& range)
+            : succ1{ nullptr }, succ2{ nullptr }, ch{ range.first }, chLast{ range.second },
+            minCount{ 0 }, maxCount{ 0 }, ty{ type } {}
     };
 
     class NFA {
         NFAnode* first;
         NFAnode* last;
         size_t sz;                          // size
-        static std::allocator<NFAnode> alloc;
+        NodeArena<NFAnode> arena;           // storage of the nodes
     private:
         NFA()
             : first{ nullptr }, last{ nullptr }, sz{ 0 } {}
 
         // const members
         std::vector<NFAnode*> GetAllNodes() const;
-        void AddNodeToSet(std::vector<NFAnode*>& set, NFAnode* node) const;
-        void ReleaseResources() const;
-        NFAnode* CreateNFANode(const NFAnode::Type type) const;
-        NFAnode* CreateNFANode(const NFAnode::Type type, const Character character) const;
         NFA CreateCopy() const;
+        bool IsCharacterClass() const;
+
+        // nonconst members
+        NFAnode* CreateNFANode(const NFAnode::Type type);
+        NFAnode* CreateNFANode(const NFAnode::Type type, const Character character);
+        NFAnode* CreateNFANode(const NFAnode::Type type, const CharacterRange& range);
+        void ClosureCounted(const int min, const int max);
 
         // friends
+        friend struct IndexedNFA;
 #if REGEX_PRINT_FA_STATE
         friend void PrintNFA(std::ostream& os, const RE::Regexp& re);
 #endif // REGEX_PRINT_FA_STATE
     public:
         NFA(const Character character);
-        ~NFA();
+        NFA(const CharacterRange& range);
 
         NFA(const NFA& other) = delete;
         NFA& operator=(const NFA& other) = delete;
@@ -187,10 +291,12 @@ namespace RE
         size_t Size() const { return sz; }
         NFAnode* GetFirstNode() const { return first; }
         NFAnode* GetLastNode() const { return last; }
+        size_t CustomClosureSize(const int min, const int max, const Constants::ClosureType ty) const;
 
         // nonconst members
         void Concatenate(NFA& other);
         void Alternate(NFA& other);
+        void Join(NFA& other);
         void ClosureKleene();
         void ClosurePositive();
         void ClosureBinary();
@@ -201,34 +307,35 @@ namespace RE
 
     struct DFAnode;
 
-    using Transition = std::pair<Character, DFAnode*>;
+    using Transition = std::pair<CharacterRange, DFAnode*>;
     using TransitionTable = std::vector<Transition>;
 
+    // transitions are sorted and their ranges do not overlap
     struct LessTransitionCharacter {
-        bool operator()(const Transition& t, Character ch) { return t.first < ch; }
+        bool operator()(const Transition& t, Character ch) { return t.first.second < ch; }
     };
 
     struct DFAnode {
     public:
         TransitionTable trans;              // table of transitions
         bool acc;                           // accept
-        bool mark;
-        static DFAnode* hint;
+        Index label;                        // set of the patterns of an accept node in Regexp::acceptSets,
+                                            // 0 if the RE has one pattern
     public:
-        DFAnode(bool accept)
-            : acc{ accept }, mark{ false } {}
+        DFAnode(bool accept, Index acceptLabel = 0)
+            : acc{ accept }, label{ acceptLabel } {}
     };
 
     class DFA {
         DFAnode* first;
         size_t sz;                          // size
-        static std::allocator<DFAnode> alloc;
+        NodeArena<DFAnode> arena;           // storage of the nodes
     private:
         // const members
         std::vector<DFAnode*> GetAllNodes() const;
-        void AddNodeToSet(std::vector<DFAnode*>& set, DFAnode* node) const;
-        void ReleaseResources() const;
-        DFAnode* CreateDFANode(const bool accept) const;
+
+        // nonconst members
+        DFAnode* CreateDFANode(const bool accept, const Index label = 0);
 
         // friends
         friend class Regexp;
@@ -240,7 +347,6 @@ namespace RE
     public:
         DFA()
             : first{ nullptr }, sz{ 0 } {}
-        ~DFA();
 
         DFA(const DFA& other) = delete;
         DFA& operator=(const DFA& other) = delete;
@@ -251,21 +357,407 @@ namespace RE
         size_t Size() const { return sz; }
     };
 
+    ///----------------------------------------------------------------------------------------------------
+
+    using ClassIndex = unsigned int;
+    using ClassRange = std::pair<CharacterRange, ClassIndex>;
+    using StateIndex = unsigned int;
+
+    // two-level lookup table that maps a character to the index of its equivalence class; the directory ends
+    // at the block of the last character of a class other than 0, so a map without such characters is empty
+    class CharacterClassMap {
+        std::vector<unsigned int> directory;    // first level: offset of the block of each 'classBlockSize' characters
+        std::vector<ClassIndex> blocks;     // second level: blocks of class indexes, block #0 is filled with 0
+        ClassIndex beyond;                  // class of the characters above ALLSUPPLEMENTARYPLANES_MAX
+    public:
+        CharacterClassMap();
+        CharacterClassMap(const std::vector<ClassRange>& ranges);
+
+        // friends
+        friend bool operator==(const CharacterClassMap& left, const CharacterClassMap& right);
+
+        // const members
+        size_t MemoryUsage() const
+        {
+            return directory.capacity() * sizeof(unsigned int) + blocks.capacity() * sizeof(ClassIndex);
+        }
+        ClassIndex operator[](const Character ch) const
+        {
+            const Character dir = ch >> Constants::classBlockBits;
+            if (dir >= directory.size()) {
+                return (ch > ALLSUPPLEMENTARYPLANES_MAX) ? beyond : 0;
+            }
+            return blocks[directory[dir] + (ch & Constants::classBlockMask)];
+        }
+    };
+
+    // set of a few character ranges, the text is searched for its characters with SSE2 instructions
+    // if they are enabled (REGEX_ENABLE_SSE2) and available
+    class CharacterRangeSet {
+        std::vector<CharacterRange> ranges; // sorted disjoint ranges, at most 'maxRanges'
+    public:
+        static constexpr size_t maxRanges = 4;
+    public:
+        CharacterRangeSet() {}
+        CharacterRangeSet(std::vector<CharacterRange> ranges);
+
+        // const members
+        bool Contains(const Character ch) const;
+        const char32_t* FindFirst(const char32_t* first, const char32_t* last) const;
+        const char32_t* FindLast(const char32_t* first, const char32_t* last) const;
+        const unsigned char* FindLast(const unsigned char* first, const unsigned char* last) const;
+        size_t Count(const char32_t* first, const char32_t* last) const;
+    };
+
+    // DFA stored as a dense 'state x class' array of state indexes
+    // the accept states are numbered last, so a state is accepting if its index is not less than 'firstAccept'
+    class DenseDFA {
+        CharacterClassMap classes;
+        std::vector<ClassRange> ranges;     // character ranges of the classes other than 0
+        std::vector<StateIndex> trans;      // table of transitions, row 'state' holds 'nClasses' columns
+        size_t nStates;                     // number of states
+        size_t nClasses;                    // number of classes
+        StateIndex start;
+        StateIndex firstAccept;             // the first accept state
+        std::vector<Index> labels;          // label of each accept state from 'firstAccept' on if the RE
+                                            // has several patterns
+
+        // friends
+        friend class Regexp;
+        friend bool operator==(const DenseDFA& left, const DenseDFA& right);
+    public:
+        static constexpr StateIndex dead = 0;   // state without transitions to other states
+    public:
+        DenseDFA()
+            : trans(1, dead), nStates{ 1 }, nClasses{ 1 }, start{ dead }, firstAccept{ 1 } {}
+
+        // const members
+        size_t Size() const { return nStates; }
+        size_t ClassCount() const { return nClasses; }
+        StateIndex Start() const { return start; }
+        StateIndex Next(const StateIndex state, const Character ch) const { return trans[state * nClasses + classes[ch]]; }
+        bool IsAccept(const StateIndex state) const { return state >= firstAccept; }
+        Index Label(const StateIndex state) const { return labels[state - firstAccept]; }
+        ClassIndex Class(const Character ch) const { return classes[ch]; }
+        size_t MemoryUsage() const;
+    };
+
+    // DFA that reads the text from right to left, its state at position i is the set of the states of
+    // the DenseDFA from which an accept state is reachable on the characters from position i onwards
+    class ReverseDFA {
+        std::vector<StateIndex> trans;      // table of transitions, row 'state' holds 'nClasses' columns
+        std::vector<bool> live;             // row 'state' holds the set of the DenseDFA states, 'nLive' bits
+        size_t nStates;                     // number of states
+        size_t nClasses;                    // number of classes, the same as in the DenseDFA
+        size_t nLive;                       // number of the DenseDFA states
+        StateIndex start;                   // state at the end of the text: the set of the accept states
+        CharacterRangeSet wake;             // characters on which 'start' may go to another state
+
+        // friends
+        friend class Regexp;
+    public:
+        ReverseDFA()
+            : nStates{ 0 }, nClasses{ 1 }, nLive{ 0 }, start{ 0 } {}
+
+        // const members
+        size_t Size() const { return nStates; }
+        StateIndex Start() const { return start; }
+        StateIndex Next(const StateIndex state, const ClassIndex cl) const { return trans[state * nClasses + cl]; }
+        bool IsLive(const StateIndex state, const StateIndex forward) const { return live[state * nLive + forward]; }
+        const CharacterRangeSet& Wake() const { return wake; }
+        size_t MemoryUsage() const { return trans.capacity() * sizeof(StateIndex) + live.capacity() / 8; }
+    };
+
+    // substring that every match contains, its occurrences are found by scanning the text for its rarest character
+    class Prefilter {
+        std::u32string literal;
+        size_t rare;                        // position of the rarest character in 'literal'
+        CharacterRangeSet scan;             // the rarest character
+        std::string bytes;                  // UTF-8 encoding of 'literal'
+        size_t rareByte;                    // position of the first byte of the rarest character in 'bytes'
+    public:
+        Prefilter()
+            : rare{ 0 }, rareByte{ 0 } {}
+        Prefilter(const std::u32string& literal);
+
+        // const members
+        bool Empty() const { return literal.size() == 0; }
+        const std::u32string& Literal() const { return literal; }
+        const std::string& Bytes() const { return bytes; }
+        const char32_t* Find(const char32_t* first, const char32_t* last) const;
+        const unsigned char* Find(const unsigned char* first, const unsigned char* last) const;
+        size_t MemoryUsage() const { return literal.capacity() * sizeof(char32_t) + bytes.capacity(); }
+    };
+
+    // approximate frequency of the character in a text, 0 for the rarest characters
+    unsigned char CharacterFrequency(const Character ch);
+
+    // Boyer-Moore-Horspool search of a string, the shifts are looked up by the low byte of the character
+    class LiteralSearcher {
+        std::u32string literal;
+        std::vector<size_t> shift;          // shift of the window by the low byte of its last character
+    public:
+        LiteralSearcher() {}
+        LiteralSearcher(const std::u32string& literal);
+
+        // const members
+        bool Empty() const { return literal.size() == 0; }
+        const std::u32string& Literal() const { return literal; }
+        const char32_t* Find(const char32_t* first, const char32_t* last) const;
+        size_t MemoryUsage() const { return literal.capacity() * sizeof(char32_t) + shift.capacity() * sizeof(size_t); }
+    };
+
+    // Aho-Corasick automaton of a set of strings over the classes of their characters, the trie edges of each state
+    // are stored in one array sorted by the class, the transitions of all the states are also stored
+    // in a 'state x class' array if it is not larger than 'maxDenseSize'
+    class AhoCorasick {
+        using Edge = std::pair<ClassIndex, StateIndex>;
+        CharacterClassMap classes;          // a class for each character of the strings, class 0 for the others
+        size_t nClasses;                    // number of classes
+        std::vector<Edge> edges;            // trie edges of state 's' are [edgesFirst[s], edgesFirst[s + 1])
+        std::vector<StateIndex> edgesFirst;
+        std::vector<StateIndex> fail;       // the state of the longest proper suffix that is in the trie
+        std::vector<StateIndex> trans;      // transitions, row 'state' holds 'nClasses' columns, or empty
+        std::vector<StateIndex> depth;      // length of the prefix of the state
+        std::vector<StateIndex> out;        // length of the longest string that is a suffix of the state, or 0
+        CharacterRangeSet firstChars;       // the first characters of the strings
+    public:
+        static constexpr StateIndex root = 0;
+        static constexpr StateIndex none = std::numeric_limits<StateIndex>::max();
+        static constexpr size_t maxDenseSize = size_t{ 1 } << 22;
+    public:
+        AhoCorasick()
+            : nClasses{ 1 } {}
+        AhoCorasick(std::vector<std::u32string> strings);
+
+        // const members
+        bool Empty() const { return depth.size() == 0; }
+        ClassIndex Class(const Character ch) const { return classes[ch]; }
+        StateIndex Goto(const StateIndex state, const ClassIndex cl) const;
+        bool IsString(const StateIndex state) const { return out[state] == depth[state]; }
+        StateIndex Next(StateIndex state, const ClassIndex cl) const;
+        bool Match(const char32_t* first, const char32_t* last) const;
+        std::pair<const char32_t*, const char32_t*> Find(const char32_t* first, const char32_t* last) const;
+        const char32_t* FindEnd(const char32_t* first, const char32_t* last) const;
+        size_t MemoryUsage() const;
+    };
+
     ///----------------------------------------------------------------------------------------------------
     
+    // set of the indexes {0, 1, ..., n - 1} with O(1) insertion, membership test and clearing
+    // 'An Efficient Representation for Sparse Sets', P. Briggs, L. Torczon (1993)
+    class SparseSet {
+        std::vector<Index> dense;           // members in the order of insertion
+        std::vector<Index> sparse;          // position of the member in 'dense'
+        size_t sz;                          // size
+    public:
+        SparseSet(const size_t n)
+            : dense(n), sparse(n), sz{ 0 } {}
+
+        // const members
+        size_t Size() const { return sz; }
+        bool Contains(const Index i) const { return sparse[i] < sz && dense[sparse[i]] == i; }
+        std::vector<Index>::const_iterator begin() const { return dense.cbegin(); }
+        std::vector<Index>::const_iterator end() const { return dense.cbegin() + sz; }
+
+        // nonconst members
+        bool Insert(const Index i)
+        {
+            if (Contains(i)) {
+                return false;
+            }
+            sparse[i] = sz;
+            dense[sz++] = i;
+            return true;
+        }
+
+        void Clear() { sz = 0; }
+    };
+
+    // NFA with densely numbered nodes, used by the subset construction;
+    // a COUNTER node is not expanded, the positions of its repetition are numbered after the nodes and
+    // the nodes of its character class are not numbered
+    struct IndexedNFA {
+        // position v of a counter has transitions on the class after v characters of the class have been read
+        struct Counter {
+            Index node;                     // index of the COUNTER node
+            Index first;                    // index of position 0
+            Index size;                     // number of positions
+            Index min;                      // position v leads to the successor of the node if v + 1 >= min
+            bool loop;                      // the last position leads to itself
+            std::vector<CharacterRange> ranges;     // character class
+        };
+        std::vector<const NFAnode*> nodes;
+        std::vector<Index> succ1;           // index of succsessor 1 or 'none'
+        std::vector<Index> succ2;           // index of succsessor 2 or 'none'
+        std::vector<Index> closure;         // sorted Epsilon-closures of all nodes, only non-Epsilon nodes are kept,
+                                            // a COUNTER node is replaced with its position 0
+        std::vector<Index> closureFirst;    // position of the closure of the node in 'closure'
+        std::vector<Counter> counters;      // sorted by 'first'
+        Index first;
+        Index last;
+        size_t sz;                          // number of nodes and positions
+        static constexpr Index none = std::numeric_limits<Index>::max();
+    public:
+        IndexedNFA(const NFA& nfa);
+
+        // const members
+        size_t Size() const { return sz; }
+        bool IsPosition(const Index i) const { return i >= nodes.size(); }
+        Index CounterIndex(const Index position) const;
+        const Index* ClosureBegin(const Index i) const { return closure.data() + closureFirst[i]; }
+        const Index* ClosureEnd(const Index i) const { return closure.data() + closureFirst[i + 1]; }
+    };
+
+    using StateSet = std::vector<Index>;                        // sorted indexes of NFA nodes
+
+    struct StateSetHash {
+        size_t operator()(const StateSet& set) const;
+    };
+
     using SubsetTableIndex = int;
     constexpr SubsetTableIndex noTransition = -1;
 
     struct SubsetTableEntry {
-        const std::set<const NFAnode*> state;                   // set of NFAnode*
+        const StateSet* state;                                  // key of the subset map
         std::vector<SubsetTableIndex> trans;                    // transitions to SubsetTableEntry
     };
 
     using SubsetTable = std::vector<SubsetTableEntry>;
+    using SubsetMap = std::unordered_map<StateSet, SubsetTableIndex, StateSetHash>;
+
+    class LazyDFA;
+
+    // the states of a lazy DFA created by one thread, two caches of at most 'cacheSize' states,
+    // a cache is cleared when it is full; a LazyCache must not be used by two threads at once
+    class LazyCache {
+        struct Cache {
+            std::vector<StateSet> sets;                         // nodes of each state
+            std::unordered_map<StateSet, StateIndex, StateSetHash> states;
+            std::vector<StateIndex> trans;                      // row 'state' holds 'nClasses' columns
+            size_t generation = 0;                              // number of times the cache has been cleared
+            bool isForward = false;
+        };
+        Cache forward;
+        Cache backward;
+        Cache unanchored;                   // forward states of the search for a match that begins anywhere
+        StateSet reached;                   // unsorted nodes of the next state
+        std::shared_ptr<const int> owner;   // identity of the lazy DFA whose states are cached
+    private:
+        // friends
+        friend class LazyDFA;
+    };
+
+    // DFA whose states are created from the NFA when the text reaches them, the states are kept in a LazyCache,
+    // so one LazyDFA is shared by the threads;
+    // a forward state is the Epsilon-closed set of the nodes reached from the first node,
+    // a backward state at position i is the set of the nodes that have a transition on the character i
+    // after which the last node is reachable on the characters from position i + 1 onwards
+    class LazyDFA {
+        using Cache = LazyCache::Cache;
+        CharacterClassMap classes;          // class k + 1 for the range k of the alphabet, class 0 for the others
+        size_t nClasses;                    // number of classes
+        std::vector<ClassIndex> firstClass; // node i has transitions on the classes [firstClass[i], lastClass[i]]
+        std::vector<ClassIndex> lastClass;
+        std::vector<Index> closure;         // sorted Epsilon-closures of the successors of the nodes
+        std::vector<Index> closureFirst;    // position of the closure of the successor of the node in 'closure'
+        std::vector<Index> preds;           // nodes whose successor's closure contains the node, position 0 of
+                                            // a counter stands for its positions that lead to the successor
+        std::vector<Index> predsFirst;      // position of the nodes of the node in 'preds'
+        std::vector<IndexedNFA::Counter> counters;
+        std::vector<bool> counterClasses;   // row k holds 'nClasses' flags of the classes of the counter k
+        Index nNodes;                       // number of nodes, the positions of the counters follow them
+        StateSet first;                     // Epsilon-closure of the first node
+        Index last;
+        size_t cacheSize;                   // maximum number of the states of each cache
+        std::shared_ptr<const int> identity;    // held by the caches of this DFA, so it is not reused while they exist
+    public:
+        static constexpr StateIndex dead = 0;                   // empty set in both caches
+        static constexpr StateIndex start = 1;                  // the forward state of 'first'
+        static constexpr StateIndex unknown = std::numeric_limits<StateIndex>::max();
+        static constexpr size_t maxBlockSize = 4096;
+    private:
+        // const members
+        Index CounterIndex(const Index position) const;
+        bool HasClass(const Index counter, const ClassIndex cl) const { return counterClasses[counter * nClasses + cl]; }
+        void AddPredecessors(const Index node, const ClassIndex cl, StateSet& set) const;
+        void Successors(const StateSet& set, const ClassIndex cl, StateSet& reached) const;
+        StateIndex Insert(Cache& cache, StateSet&& set) const;
+        StateIndex Add(Cache& cache, StateSet&& set) const;
+        StateIndex Transition(LazyCache& c, const StateIndex state, const Character ch, const bool unanchored) const;
+        void Clear(Cache& cache) const;
+    public:
+        LazyDFA()
+            : nClasses{ 1 }, nNodes{ 0 }, last{ 0 }, cacheSize{ 0 } {}
+        LazyDFA(const IndexedNFA& inf, const std::vector<CharacterRange>& alphabet, const size_t cacheSize);
+
+        // const members
+        bool Empty() const { return cacheSize == 0; }
+        ClassIndex Class(const Character ch) const { return classes[ch]; }
+        bool AcceptsEmpty() const { return std::binary_search(first.begin(), first.end(), last); }
+        bool IsAccept(const LazyCache& c, const StateIndex state) const
+        {
+            return std::binary_search(c.forward.sets[state].begin(), c.forward.sets[state].end(), last);
+        }
+        bool IsLive(const LazyCache& c, const StateIndex state, const StateIndex backwardState) const;
+        const StateSet& BackwardSet(const LazyCache& c, const StateIndex state) const { return c.backward.sets[state]; }
+        size_t BlockSize() const { return std::min(maxBlockSize, cacheSize / 2); }
+        void Prepare(LazyCache& c) const;
+        StateIndex Forward(LazyCache& c, const StateIndex state, const Character ch) const;
+        StateIndex ForwardUnanchored(LazyCache& c, const StateIndex state, const Character ch) const;
+        bool IsAcceptUnanchored(const LazyCache& c, const StateIndex state) const
+        {
+            return std::binary_search(c.unanchored.sets[state].begin(), c.unanchored.sets[state].end(), last);
+        }
+        StateIndex Backward(LazyCache& c, const StateIndex state, const Character ch) const;
+        StateIndex BackwardState(LazyCache& c, const StateSet& set, const size_t room) const;
+        void Step(LazyCache& c, std::vector<StateIndex>& states, const Character ch) const;
+        size_t MemoryUsage() const;
+    };
 
     using UString = std::u32string;                             // Unicode string
 
-    using SetPartition = std::vector<std::vector<DFAnode*>>;
+    // transition of a DFA with numbered states, 'symbol' is the index of the range in the alphabet
+    struct NumberedTransition {
+        Index from;
+        Index symbol;
+        Index to;
+    };
+
+    // refinable partition of the set {0, 1, ..., n - 1}, the elements of a block are contiguous in 'elems'
+    // 'Efficient minimization of DFAs with partial transition functions', A. Valmari, P. Lehtinen (2008)
+    class RefinablePartition {
+        std::vector<Index> elems;           // elements ordered by blocks
+        std::vector<Index> loc;             // location of the element in 'elems'
+        std::vector<Index> set;             // block of the element
+        std::vector<Index> first;           // beginning of the block in 'elems'
+        std::vector<Index> past;            // end of the block in 'elems'
+        std::vector<Index> marked;          // number of marked elements of the block
+        std::vector<Index> touched;         // blocks that have marked elements
+        size_t sz;                          // number of blocks
+    public:
+        RefinablePartition(const std::vector<Index>& initial);
+
+        // const members
+        size_t Size() const { return sz; }
+        Index GetBlock(const Index element) const { return set[element]; }
+        Index GetFirst(const Index block) const { return first[block]; }
+        Index GetPast(const Index block) const { return past[block]; }
+        Index GetElement(const Index location) const { return elems[location]; }
+
+        // nonconst members
+        void Mark(const Index element);
+        void Split();
+    };
+
+    std::vector<Index> PartitionStates(
+        const std::vector<bool>& accept,
+        const std::vector<NumberedTransition>& trans);
+
+    std::vector<Index> PartitionStates(
+        const std::vector<Index>& labels,
+        const std::vector<NumberedTransition>& trans);
+
     constexpr size_t ringBufferSize = 4;
 
     struct MatchResults {
@@ -282,6 +774,56 @@ namespace RE
             : ln{ lineNumber }, pos{ positionInLine }, str{ begin, end } {}
     };
 
+    // match in a UTF-8 text, the line and the position in line are counted in characters
+    struct Utf8MatchResults {
+        using Matched = std::pair<const char*, const char*>;
+
+        MatchResults::LineNumber ln;
+        MatchResults::PositionInLine pos;
+        size_t offset;                      // offset of the first byte of the match in the text
+        Matched str;
+    };
+
+    // limits of the resources used to compile a regular expression, 0 is no limit;
+    // the compilation stops with Error::CompileLimitExceeded as soon as a limit is exceeded
+    struct CompileOptions {
+        size_t maxNFANodes = 0;             // number of the nodes of the NFA
+        size_t maxDFAStates = 0;            // number of the states of each DFA built by a subset construction
+        size_t maxAlphabetSize = 0;         // number of the ranges of the alphabet
+        size_t maxTime = 0;                 // wall time in milliseconds
+    };
+
+    // state of a search of [first, last) of a text that finds the matches one by one,
+    // so the search may stop after any match and go on later
+    class SearchState {
+        // consecutive positions where the reverse DFA is not in its start state, elsewhere only the accept states
+        // can reach an accept state and a match cannot start
+        struct LiveRun {
+            size_t first;
+            size_t last;
+            size_t offset;                  // position of the state of 'last' in 'states'
+        };
+        size_t first;
+        size_t last;
+        size_t begin;                       // where the next match may begin
+        size_t searched;                    // end of the part whose runs or backward states are found
+        size_t rangeLast;                   // end of the part of the runs
+        std::vector<StateIndex> states;     // states of the reverse DFA in the runs, from the end of the part
+        std::vector<LiveRun> runs;
+        size_t run;                         // the first run that does not end before 'begin'
+        std::vector<StateSet> ends;         // the lazy backward states at the multiples of the block size
+        std::vector<StateIndex> block;      // the lazy backward states at [blockFirst, blockLast]
+        size_t blockFirst;
+        size_t blockLast;
+
+        // friends
+        friend class Regexp;
+    public:
+        SearchState(const size_t first, const size_t last)
+            : first{ first }, last{ last }, begin{ first }, searched{ first }, rangeLast{ first }, run{ 0 },
+            blockFirst{ 0 }, blockLast{ 0 } {}
+    };
+
     class Regexp {
         class TokenStream {
         public:
@@ -343,32 +885,40 @@ namespace RE
         UString source;
         TokenStream ts;
         std::pair<Character, TokenStream::TokenType> token;
-        std::set<Character> alphabetTemp;
-        std::vector<Character> alphabet;
+        std::vector<CharacterRange> alphabetTemp;               // ranges of the NFA, they may overlap
+        std::vector<CharacterRange> alphabet;                   // sorted disjoint ranges
         NFA nfa;
-        DFA dfa;
-        Character last;
+        DFA dfa;                                                // released after 'table' is created
+        DenseDFA table;                                         // matcher
+        mutable ReverseDFA reverse;                             // finds where the matches can continue, see Reverse()
+        CharacterRangeSet newLines;                             // characters that start a new line
+        Prefilter prefilter;                                    // finds the parts of the text that may match
+        LiteralSearcher literal;                                // the RE without operators, no automata then
+        AhoCorasick keywords;                                   // the RE is an alternation of strings
+        LazyDFA lazy;                                           // used instead of 'table' with REGFL_LAZYDFA
+        LazyDFA fallback;                                       // searches if 'reverse' is too large
+        DenseDFA utf8Table;                                     // matcher of UTF-8 text with REGFL_UTF8
+        mutable ReverseDFA utf8Reverse;
+        mutable std::mutex reverseMutex;                        // guards the creation of the reverse DFAs
+        mutable std::atomic<bool> reverseReady;
+        mutable std::atomic<bool> utf8ReverseReady;
+        std::vector<const NFAnode*> lasts;                      // the last node of each pattern of a set
+        std::vector<std::vector<Index>> acceptSets;             // patterns of each label of the accept states of a set
         RegexpFlags fl;
+        size_t cacheSize;                                       // size of the caches of 'lazy'
+        CompileOptions options;
+        std::chrono::steady_clock::time_point deadline;         // end of the compilation if 'options.maxTime' is set
     private:
         // const members
-        std::set<const NFAnode*> Delta(
-            const std::set<const NFAnode*>& set,
-            const Character ch) const;
-
-        std::set<const NFAnode*> EpsilonClosure(
-            const std::set<const NFAnode*>& set) const;
-
-        void AddNodesReachableViaEpsilonTransition(
-            std::set<const NFAnode*>& set,
-            const NFAnode* node) const;
+        void Delta(
+            const IndexedNFA& inf,
+            const StateSet& set,
+            const CharacterRange& range,
+            SparseSet& reached) const;
 
-        bool Equal(
-            const std::set<const NFAnode*>& a,
-            const std::set<const NFAnode*>& b) const;
-
-        std::pair<std::vector<DFAnode*>, std::vector<DFAnode*>> Split(
-            const std::vector<DFAnode*>& set,
-            const std::unordered_map<const DFAnode*, Index>& indexes) const;
+        StateSet EpsilonClosure(
+            const IndexedNFA& inf,
+            SparseSet& reached) const;
 
         const DFAnode* FindTransition(
             const DFAnode* node,
@@ -376,24 +926,19 @@ namespace RE
 
         bool TransitionExists(const DFAnode* node) const { return (node == nullptr) ? false : true; }
 
-        void AssignNumber(
-            const std::vector<DFAnode*>& set,
-            const Index index,
-            std::unordered_map<const DFAnode*, Index>& indexes) const;
-
         DFA CreateMinimalDFA(
-            const SetPartition& sp,
-            const std::unordered_map<const DFAnode*, Index>& indexes) const;
-
-        void CheckNFA() const;
+            const std::vector<DFAnode*>& nodes,
+            const std::vector<Index>& blocks) const;
 
-        DFAnode* TakeStepThroughDFA(
-            const DFAnode* current,
-            const Character ch) const;
+        DenseDFA CreateDenseDFA() const;
+        DenseDFA CreateUtf8DFA() const;
+        ReverseDFA CreateReverseDFA(const DenseDFA& forward) const;
+        const ReverseDFA& Reverse() const;
+        const ReverseDFA& Utf8Reverse() const;
+        const LazyDFA& SearchLazy() const { return lazy.Empty() ? fallback : lazy; }
+        Prefilter CreatePrefilter() const;
 
-        std::vector<DFAnode*> TakeStepThroughDFA(
-            std::vector<DFAnode*>& currentState,
-            const Character ch) const;
+        std::vector<CharacterRange> PartitionAlphabet() const;
 
         bool IsNewLineSymbol(const Character ch) const;
 
@@ -403,16 +948,79 @@ namespace RE
             size_t& line,
             size_t& pos) const;
 
+        void AdjustPositions(
+            const unsigned char* first,
+            const unsigned char* last,
+            size_t& line,
+            size_t& pos) const;
+
+        template<class CharT>
+        void FindLiveRuns(
+            const DenseDFA& forward,
+            const ReverseDFA& backward,
+            const CharT* text,
+            const size_t first,
+            const size_t last,
+            const size_t stop,
+            SearchState& state) const;
+
+        template<class CharT>
+        bool NextInRuns(
+            const DenseDFA& forward,
+            const ReverseDFA& backward,
+            const CharT* text,
+            SearchState& state,
+            size_t& begin,
+            size_t& end) const;
+
+        template<class CharT, class Report>
+        void ScanRange(
+            const DenseDFA& forward,
+            const ReverseDFA& backward,
+            const CharT* text,
+            const size_t first,
+            const size_t last,
+            Report report) const;
+
+        void PrepareLazy(const UString& string, SearchState& state, LazyCache& cache) const;
+        StateIndex LazyLive(const char32_t* text, const size_t i, SearchState& state, LazyCache& cache) const;
+        bool NextLazy(const UString& string, SearchState& state, LazyCache& cache, size_t& begin, size_t& end) const;
+        bool NextMatch(const UString& string, SearchState& state, LazyCache& cache, size_t& begin, size_t& end) const;
+        bool NextPrefilterRange(const char32_t* text, const size_t searched, const size_t last,
+            size_t& first, size_t& end) const;
+        size_t EarliestEndInRange(
+            const char32_t* text,
+            const size_t first,
+            const size_t last,
+            std::vector<StateIndex>& states,
+            std::vector<StateIndex>& next,
+            std::vector<size_t>& marks) const;
+        template<class Found>
+        bool SearchWindows(const char32_t* text, const size_t n, const ReverseDFA& backward, Found found) const;
+
+        template<class Visit>
+        bool SearchChunk(
+            const UString& string,
+            const size_t first,
+            const size_t last,
+            LazyCache& cache,
+            Visit visit) const;
+
+        bool IsSeparator(const Character ch) const;
+
         // nonconst members
         void NextToken(const bool beginSubstring = true) { ts.Advance(beginSubstring); token = ts.GetToken(); }
-        void AddToAlphabet(const Character ch) { alphabetTemp.emplace(ch); }
+        void AddToAlphabet(const CharacterRange& range) { alphabetTemp.push_back(range); }
         void MakeDFA();
+        void MakeSetDFA(const std::vector<UString>& patterns, const bool unanchored);
+        void MakeLazyDFA();
         void REtoNFA();
+        void MakeAlphabet();
         std::vector<DFAnode*> NFAtoDFA();
         void MinimizeDFA(const std::vector<DFAnode*> nodes);
-        void SetFlags();
     private:
         // Parsing
+        bool PStrings(std::vector<UString>& strings);
          NFA PGoal();
          NFA PAlternation();
         void PAlternationPrime(NFA& a);
@@ -422,14 +1030,13 @@ namespace RE
          NFA PBlock();
          NFA PCharacterClass();
         bool PNegation();
-         NFA PCharacterClassRange(const CharacterFlags flags, const Constants::AtomType type);
-        void PCharacterClassRangePrime(const CharacterFlags flags, const Constants::AtomType type, NFA& a);
+        void PCharacterClassRange(std::vector<CharacterRange>& ranges);
+        void PCharacterClassRangePrime(std::vector<CharacterRange>& ranges);
         void CheckRange(Character first, Character last);
-         NFA PAtom(
-                const CharacterFlags flags = CHARFL_NOFLAGS,
-                const Constants::AtomType type = Constants::AtomType::STANDART);
+         NFA PAtom();
          NFA PNotNewline();
-         NFA PEscape(const CharacterFlags flags, const Constants::AtomType type);
+        Character PCharacter(const Constants::AtomType type);
+        Character PEscape(const Constants::AtomType type);
         Character PGetControlCode();
         Character PGetASCIICharacter();
         Character PGetUnicodeCharacter(const int nDigits);
@@ -439,36 +1046,339 @@ namespace RE
         void PCountMore(int& max, Constants::ClosureType& ty);
         void PMax(int& max, Constants::ClosureType& ty);
          int PGetInteger();
+         NFA MakeCharacterClass(std::vector<CharacterRange>& ranges, const bool negated);
+
         void ThrowInvalidRegexCharacter(const size_t position) const;
         void ThrowInvalidRegexRange(const size_t position, const UString& range) const;
         void ThrowInvalidRegexEscape(const size_t position, const UString& escapeSequence) const;
         void ThrowInvalidRegex(const std::string& message) const;
+        void ThrowCompileLimitExceeded(const std::string& message) const;
+        void CheckNFANodes(const size_t nNodes) const;
+        void CheckDFAStates(const size_t nStates) const;
+        void CheckTime() const;
+
+        Regexp(
+            const std::vector<UString>& patterns,
+            const bool unanchored,
+            const CompileOptions& compileOptions);
     public:
-        Regexp(const UString& string);
+        Regexp(
+            const UString& string,
+            const RegexpFlags flags = REGFL_NOFLAGS,
+            const size_t cacheSize = Constants::lazyCacheSize,
+            const CompileOptions& compileOptions = CompileOptions{});
 
         Regexp(const Regexp& other) = delete;
         Regexp& operator=(const Regexp& other) = delete;
         Regexp(Regexp&& other) = delete;
         Regexp& operator=(Regexp&& other) = delete;
 
-        // const members
-        bool Match(const UString& string);
-        std::vector<MatchResults> Search(const UString& string);
+        // const members, they may be called by several threads at once
+        bool Match(const UString& string) const;
+        bool Match(const UString& string, LazyCache& cache) const;
+        std::vector<MatchResults> Search(const UString& string) const;
+        std::vector<MatchResults> Search(const UString& string, LazyCache& cache) const;
+        bool Search(const UString& string, const std::function<bool(const MatchResults&)>& visit) const;
+        MatchRange Matches(const UString& string) const;
+        bool Contains(const UString& string) const;
+        bool Contains(const UString& string, LazyCache& cache) const;
+        MatchResults::Matched FindFirst(const UString& string) const;
+        MatchResults::Matched FindFirst(const UString& string, LazyCache& cache) const;
+        size_t Count(const UString& string) const;
+        size_t Count(const UString& string, LazyCache& cache) const;
+        size_t EarliestMatchEnd(const UString& string) const;
+        size_t EarliestMatchEnd(const UString& string, LazyCache& cache) const;
+        std::vector<MatchResults> SearchParallel(const UString& string, const size_t nThreads = 0) const;
+        bool Match(const char* first, const char* last) const;
+        bool Match(const std::string& string) const { return Match(string.data(), string.data() + string.size()); }
+        std::vector<Utf8MatchResults> Search(const char* first, const char* last) const;
+        std::vector<Utf8MatchResults> Search(const std::string& string) const
+        {
+            return Search(string.data(), string.data() + string.size());
+        }
+        const UString& RequiredLiteral() const { return literal.Empty() ? prefilter.Literal() : literal.Literal(); }
+        size_t MemoryUsage() const;
 
         // nonconst members
         void PutRE(const UString& string);
+        void PutRE(const UString& string, const CompileOptions& compileOptions);
 
         // friends
         friend bool operator==(const Regexp& left, const Regexp& right);
         friend bool operator!=(const Regexp& left, const Regexp& right);
+        friend class StreamMatcher;
+        friend class RegexSet;
+        friend class Scanner;
+        friend class MatchIterator;
 #if REGEX_PRINT_FA_STATE
         friend void PrintNFA(std::ostream& os, const RE::Regexp& re);
         friend void PrintDFA(std::ostream& os, const RE::Regexp& re);
 #endif // REGEX_PRINT_FA_STATE
     };
 
+    // input iterator over the matches of a Regexp in a text, each match is found when the iterator
+    // is incremented to it, so nothing is stored per match; the matches are the same as the ones of Search,
+    // the default iterator is the end; the Regexp and the text must outlive the iterator
+    class MatchIterator {
+        const Regexp* re;                   // nullptr at the end
+        const UString* string;
+        LazyCache cache;
+        SearchState state;
+        UString::const_iterator iter;       // end of the text where the positions are counted
+        size_t line;
+        size_t pos;
+        MatchResults current;
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type        = MatchResults;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const MatchResults*;
+        using reference         = const MatchResults&;
+    public:
+        MatchIterator()
+            : re{ nullptr }, string{ nullptr }, state{ 0, 0 }, line{ 1 }, pos{ 1 }, current{ 0, 0, {}, {} } {}
+        MatchIterator(const Regexp& regexp, const UString& string);
+
+        // const members
+        const MatchResults& operator*() const { return current; }
+        const MatchResults* operator->() const { return &current; }
+
+        // nonconst members
+        MatchIterator& operator++();
+
+        // friends
+        friend bool operator==(const MatchIterator& left, const MatchIterator& right)
+        {
+            return left.re == right.re && (left.re == nullptr || left.current.str.first == right.current.str.first);
+        }
+        friend bool operator!=(const MatchIterator& left, const MatchIterator& right) { return !(left == right); }
+    };
+
+    // the matches of a Regexp in a text for a range-based for loop
+    class MatchRange {
+        const Regexp& re;
+        const UString& string;
+    public:
+        MatchRange(const Regexp& regexp, const UString& string)
+            : re{ regexp }, string{ string } {}
+
+        // const members
+        MatchIterator begin() const { return MatchIterator{ re, string }; }
+        MatchIterator end() const { return MatchIterator{}; }
+    };
+
+    // match found by a StreamMatcher, the matched characters are copied since the stream is not kept
+    struct StreamMatch {
+        MatchResults::LineNumber ln;
+        MatchResults::PositionInLine pos;
+        size_t offset;                      // position of the first character in the stream
+        UString str;
+    };
+
+    // Search over a text that arrives in chunks: the anchored automaton of the Regexp is run from each position
+    // where a match may begin, the runs in the same state are joined into the earliest one;
+    // a match is reported as soon as no run that begins not after it can reach an accept state, so the matches
+    // are the same as the ones of Search over the whole text, and only the characters from the beginning
+    // of the earliest run are kept; the runs after a match that may still grow look for the next matches,
+    // so each character is read once; the Regexp must outlive the StreamMatcher
+    class StreamMatcher {
+        struct Run {
+            size_t first;                   // position in the stream where the run begins
+            StateIndex state;               // state 0 is dead in all the modes
+        };
+        struct Match {
+            size_t first;
+            size_t last;
+        };
+        const Regexp& re;
+        LazyCache cache;
+        UString buffer;                     // the characters of the stream from 'bufferFirst'
+        size_t bufferFirst;
+        size_t next;                        // position of the next character to read
+        size_t steps;                       // number of the steps of the runs since the last reset
+        std::vector<Run> runs;              // sorted by 'first', the states are distinct
+        std::vector<StateIndex> states;     // states of 'runs' during a step
+        std::vector<Match> pending;         // matches that the earlier runs may still replace, each one begins
+                                            // at or after the end of the previous one
+        size_t reported;                    // number of the reported matches of 'pending'
+        size_t counted;                     // position in the stream of 'line' and 'pos'
+        size_t line;
+        size_t pos;
+    public:
+        static constexpr size_t maxScannedRuns = 16;    // more runs are joined by sorting them by the state
+    private:
+        // const members
+        StateIndex Start() const;
+        StateIndex Next(const StateIndex state, const Character ch) const;
+        bool IsAccept(const StateIndex state) const;
+
+        // nonconst members
+        void Step(const Character ch);
+        void Read(std::vector<StreamMatch>& matches);
+        void Report(std::vector<StreamMatch>& matches);
+        void Count(const size_t position);
+    public:
+        StreamMatcher(const Regexp& regexp);
+
+        StreamMatcher(const StreamMatcher& other) = delete;
+        StreamMatcher& operator=(const StreamMatcher& other) = delete;
+
+        // const members
+        size_t Position() const { return bufferFirst + buffer.size(); }
+        size_t Retained() const { return buffer.size(); }
+        size_t Steps() const { return steps; }
+
+        // nonconst members
+        std::vector<StreamMatch> Feed(const UString& chunk);
+        std::vector<StreamMatch> Finish();
+        void Reset();
+    };
+
+    // process-wide cache of compiled regular expressions keyed by the source and the compilation parameters,
+    // a handle shares the immutable Regexp, so an evicted Regexp lives while its handles exist;
+    // the least recently used Regexps are evicted when their memory exceeds the budget,
+    // the lookups take a shared lock, so they do not wait for each other
+    class RegexCache {
+    public:
+        using Handle = std::shared_ptr<const Regexp>;
+
+        struct Statistics {
+            size_t hits;
+            size_t misses;
+            size_t evictions;
+            size_t size;                    // number of the cached Regexps
+            size_t memory;                  // memory of the cached Regexps in bytes
+        };
+    private:
+        struct Key {
+            UString source;
+            RegexpFlags flags;
+            size_t cacheSize;
+            CompileOptions options;
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const;
+        };
+
+        struct KeyEqual {
+            bool operator()(const Key& left, const Key& right) const;
+        };
+
+        struct Entry {
+            Handle re;
+            size_t memory;
+            mutable std::atomic<size_t> lastUse;        // value of 'clock' at the last lookup
+
+            Entry(Handle re, const size_t memory, const size_t lastUse)
+                : re{ std::move(re) }, memory{ memory }, lastUse{ lastUse } {}
+        };
+
+        std::unordered_map<Key, std::unique_ptr<Entry>, KeyHash, KeyEqual> entries;
+        mutable std::shared_timed_mutex mutex;          // shared by the lookups, exclusive for the changes
+        size_t budget;                                  // maximum memory of the cached Regexps
+        size_t memory;
+        std::atomic<size_t> clock;                      // incremented by each lookup
+        std::atomic<size_t> hits;
+        std::atomic<size_t> misses;
+        std::atomic<size_t> evictions;
+    private:
+        // nonconst members
+        void Evict(const Entry* keep);
+    public:
+        static constexpr size_t defaultBudget = size_t{ 64 } << 20;
+    public:
+        RegexCache(const size_t budget = defaultBudget);
+
+        RegexCache(const RegexCache& other) = delete;
+        RegexCache& operator=(const RegexCache& other) = delete;
+
+        // const members
+        Statistics GetStatistics() const;
+        size_t Budget() const { return budget; }
+
+        // nonconst members, they may be called by several threads at once
+        Handle Get(
+            const UString& string,
+            const RegexpFlags flags = REGFL_NOFLAGS,
+            const size_t cacheSize = Constants::lazyCacheSize,
+            const CompileOptions& compileOptions = CompileOptions{});
+        void Clear();
+
+        static RegexCache& Global();
+    };
+
+    // match of a pattern of a RegexSet
+    struct SetMatch {
+        Index pattern;                      // index of the pattern in the set
+        size_t end;                         // end of the first match of the pattern in the text
+    };
+
+    // set of regular expressions compiled into one DFA, so the text is read once for all of them:
+    // the NFAs of the patterns are joined under one first node and the DFA runs unanchored, each accept state
+    // is labelled with the set of the patterns whose matches end there and the minimization does not join
+    // the states with different sets
+    class RegexSet {
+        Regexp re;
+        size_t nPatterns;
+    public:
+        RegexSet(
+            const std::vector<UString>& patterns,
+            const CompileOptions& compileOptions = CompileOptions{});
+
+        RegexSet(const RegexSet& other) = delete;
+        RegexSet& operator=(const RegexSet& other) = delete;
+
+        // const members, they may be called by several threads at once
+        size_t Size() const { return nPatterns; }
+        std::vector<Index> Matches(const UString& string) const;
+        std::vector<SetMatch> Search(const UString& string) const;
+        size_t MemoryUsage() const { return re.MemoryUsage(); }
+    };
+
+    // rule of a Scanner: the pattern of a token and the id of the token
+    struct ScannerRule {
+        UString pattern;
+        Index token;
+    };
+
+    // token of a text, [offset, offset + length) are the characters of the token
+    struct Token {
+        Index id;
+        size_t offset;
+        size_t length;
+    };
+
+    // scanner built from an ordered list of rules: the patterns are compiled into one DFA like the ones
+    // of a RegexSet, but anchored at the beginning of the token; each token is the longest prefix of the rest
+    // of the text matched by a rule, and the first rule wins among the rules that match it
+    class Scanner {
+        Regexp re;
+        std::vector<Index> tokens;          // token of each label of the DFA: the token of its first rule
+    public:
+        static constexpr Index error = std::numeric_limits<Index>::max();   // character not matched by any rule
+    public:
+        Scanner(
+            const std::vector<ScannerRule>& rules,
+            const CompileOptions& compileOptions = CompileOptions{});
+
+        Scanner(const Scanner& other) = delete;
+        Scanner& operator=(const Scanner& other) = delete;
+
+        // const members, they may be called by several threads at once
+        std::vector<Token> Tokenize(const UString& string) const;
+        size_t MemoryUsage() const { return re.MemoryUsage() + tokens.capacity() * sizeof(Index); }
+    };
+
+    ///----------------------------------------------------------------------------------------------------
+
     std::string GetGlyph(const Character ch, bool withQuotes = false);
+    std::string GetGlyph(const CharacterRange& range, bool withQuotes = false);
+
     std::string GetGlyph(const UString& string);
+
+    UString DecodeUtf8(const std::string& string);
+    std::string EncodeUtf8(const UString& string);
 }
 
 #endif // REGEXPR_HPP
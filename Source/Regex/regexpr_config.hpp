@@ -8,5 +8,6 @@
 #define REGEXPR_CONFIG_HPP
 
 #define REGEX_PRINT_FA_STATE 0
+#define REGEX_ENABLE_SSE2 1
 
 #endif // REGEXPR_CONFIG_HPP
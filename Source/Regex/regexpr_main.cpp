@@ -15,10 +15,14 @@
 #include<queue>
 #include<algorithm>
 #include<memory>
+#include<iterator>
+#include<functional>
 #include<cctype>
 #include<limits>
-#include<locale>
-#include<codecvt>
+#include<chrono>
+#include<atomic>
+#include<mutex>
+#include<shared_mutex>
 #include"../Error/error.hpp"
 #include"regexpr.hpp"
 
@@ -27,19 +31,16 @@ int main()
 {
     try
     {
-        std::locale loc(std::locale(), new std::codecvt_utf8<char32_t>);
-        
         const std::string inputFileName{ "Regexes.txt" };
-        std::basic_ifstream<char32_t> ifs{ inputFileName };
+        std::ifstream ifs{ inputFileName, std::ios_base::binary };
         if (!ifs) {
             Error::ErrPrint(std::cerr, Error::Level::ERROR, Error::Type::INFILE, "File: " + inputFileName);
             return 1;
         }
-        ifs.imbue(loc);
 
-        RE::UString rs;
+        std::string rs;
         std::getline(ifs, rs);
-        RE::Regexp regex{ rs };
+        RE::Regexp regex{ RE::DecodeUtf8(rs) };
 
         std::cout << std::endl << "Success!" << std::endl;
         return 0;
@@ -15,9 +15,16 @@
 #include<queue>
 #include<algorithm>
 #include<memory>
+#include<iterator>
+#include<functional>
 #include<cctype>
 #include<cstdio>
 #include<limits>
+#include<chrono>
+#include<atomic>
+#include<mutex>
+#include<shared_mutex>
+#include<thread>
 #include<locale>
 #include<codecvt>
 #include "Regex/regexpr.hpp"
@@ -43,19 +50,16 @@ namespace RegexTest
         ASSERT_EQ(n1.succ2, nullptr);
         ASSERT_EQ(n1.ty, RE::NFAnode::Type::ACCEPT);
         ASSERT_EQ(n1.ch, RE::Constants::notCharacter);
-        ASSERT_EQ(n1.mark, false);
     
         ASSERT_EQ(n2.succ1, nullptr);
         ASSERT_EQ(n2.succ2, nullptr);
         ASSERT_EQ(n2.ty, RE::NFAnode::Type::EPSILON);
         ASSERT_EQ(n2.ch, RE::Constants::notCharacter);
-        ASSERT_EQ(n2.mark, false);
     
         ASSERT_EQ(n3.succ1, nullptr);
         ASSERT_EQ(n3.succ2, nullptr);
         ASSERT_EQ(n3.ty, RE::NFAnode::Type::LITERAL);
         ASSERT_EQ(n3.ch, 'a');
-        ASSERT_EQ(n3.mark, false);
     }
     
     class NFATest : public ::testing::Test {
@@ -72,12 +76,10 @@ namespace RegexTest
         ASSERT_EQ(first1->succ2, nullptr);
         ASSERT_EQ(first1->ty, RE::NFAnode::Type::LITERAL);
         ASSERT_EQ(first1->ch, 'b');
-        ASSERT_EQ(first1->mark, false);
         ASSERT_EQ(last1->succ1, nullptr);
         ASSERT_EQ(last1->succ2, nullptr);
         ASSERT_EQ(last1->ty, RE::NFAnode::Type::ACCEPT);
         ASSERT_EQ(last1->ch, RE::Constants::notCharacter);
-        ASSERT_EQ(last1->mark, false);
 
         ASSERT_EQ(nfa2.Size(), 2);
         RE::NFAnode* first2 = nfa2.GetFirstNode();
@@ -86,12 +88,105 @@ namespace RegexTest
         ASSERT_EQ(first2->succ2, nullptr);
         ASSERT_EQ(first2->ty, RE::NFAnode::Type::LITERAL);
         ASSERT_EQ(first2->ch, '=');
-        ASSERT_EQ(first2->mark, false);
         ASSERT_EQ(last2->succ1, nullptr);
         ASSERT_EQ(last2->succ2, nullptr);
         ASSERT_EQ(last2->ty, RE::NFAnode::Type::ACCEPT);
         ASSERT_EQ(last2->ch, RE::Constants::notCharacter);
-        ASSERT_EQ(last2->mark, false);
+    }
+
+    TEST_F(NFATest, CountedRepetition) {
+        // the repetition of a character is one COUNTER node, it is not copied
+        nfa1.ClosureCustom(1000, 1000, RE::Constants::ClosureType::FINITE);
+        ASSERT_EQ(nfa1.Size(), 4);
+        RE::NFAnode* first1 = nfa1.GetFirstNode();
+        ASSERT_EQ(first1->ty, RE::NFAnode::Type::COUNTER);
+        ASSERT_EQ(first1->minCount, 1000);
+        ASSERT_EQ(first1->maxCount, 1000);
+        ASSERT_EQ(first1->succ1, nfa1.GetLastNode());
+        ASSERT_EQ(first1->succ2->ty, RE::NFAnode::Type::LITERAL);
+        ASSERT_EQ(first1->succ2->ch, 'b');
+
+        // {0,MAX} can skip the COUNTER node
+        nfa2.ClosureCustom(0, 255, RE::Constants::ClosureType::RANGE);
+        ASSERT_EQ(nfa2.Size(), 5);
+        RE::NFAnode* first2 = nfa2.GetFirstNode();
+        ASSERT_EQ(first2->ty, RE::NFAnode::Type::EPSILON);
+        ASSERT_EQ(first2->succ1->ty, RE::NFAnode::Type::COUNTER);
+        ASSERT_EQ(first2->succ2, nfa2.GetLastNode());
+    }
+
+    class CharacterClassMapTest : public ::testing::Test {
+    protected:
+        RE::CharacterClassMap cm1{};
+        RE::CharacterClassMap cm2{ std::vector<RE::ClassRange>{
+            RE::ClassRange{ RE::CharacterRange{ 'a', 'c' }, 1 },
+            RE::ClassRange{ RE::CharacterRange{ 'x', 'x' }, 2 },
+            RE::ClassRange{ RE::CharacterRange{ 0x100, 0x2FF }, 3 },
+            RE::ClassRange{ RE::CharacterRange{ 0x10FFFF, 0x7FFFFFFF }, 1 } } };
+    };
+
+    TEST_F(CharacterClassMapTest, CharacterClassMapMembers) {
+        ASSERT_EQ(cm1['a'], 0);
+        ASSERT_EQ(cm1[0x10FFFF], 0);
+        ASSERT_EQ(cm1[0x7FFFFFFF], 0);
+
+        ASSERT_EQ(cm2['a' - 1], 0);
+        ASSERT_EQ(cm2['a'], 1);
+        ASSERT_EQ(cm2['c'], 1);
+        ASSERT_EQ(cm2['d'], 0);
+        ASSERT_EQ(cm2['x'], 2);
+        ASSERT_EQ(cm2[0xFF], 0);
+        ASSERT_EQ(cm2[0x100], 3);
+        ASSERT_EQ(cm2[0x2FF], 3);
+        ASSERT_EQ(cm2[0x300], 0);
+        ASSERT_EQ(cm2[0x10FFFE], 0);
+        ASSERT_EQ(cm2[0x10FFFF], 1);
+        ASSERT_EQ(cm2[0x7FFFFFFF], 1);
+
+        // the directory ends at the last block with a class other than 0
+        ASSERT_EQ(cm1.MemoryUsage(), 0);
+        const RE::CharacterClassMap ascii{ std::vector<RE::ClassRange>{
+            RE::ClassRange{ RE::CharacterRange{ 'a', 'c' }, 1 }, RE::ClassRange{ RE::CharacterRange{ 0x80, 0x7FFFFFFF }, 0 } } };
+        ASSERT_EQ(ascii['b'], 1);
+        ASSERT_EQ(ascii[0x100], 0);
+        ASSERT_EQ(ascii[0x7FFFFFFF], 0);
+        ASSERT_LE(ascii.MemoryUsage(), 2 * RE::Constants::classBlockSize * sizeof(RE::ClassIndex) + sizeof(unsigned int));
+        ASSERT_LT(RE::Regexp{ U"abc" }.MemoryUsage(), 8192);
+    }
+
+    TEST(PartitionStatesTest, EquivalentStates) {
+        // 0 -a-> 1, 0 -b-> 2, 1 -c-> 3, 2 -c-> 4, 3 and 4 are accepting
+        const std::vector<bool> accept{ false, false, false, true, true };
+        const std::vector<RE::NumberedTransition> trans{ { 0, 0, 1 }, { 0, 1, 2 }, { 1, 2, 3 }, { 2, 2, 4 } };
+        const std::vector<RE::Index> blocks = RE::PartitionStates(accept, trans);
+        ASSERT_EQ(blocks.size(), 5);
+        ASSERT_EQ(blocks[1], blocks[2]);
+        ASSERT_EQ(blocks[3], blocks[4]);
+        ASSERT_NE(blocks[0], blocks[1]);
+        ASSERT_NE(blocks[0], blocks[3]);
+        ASSERT_NE(blocks[1], blocks[3]);
+    }
+
+    TEST(PartitionStatesTest, ChainOfStates) {
+        // 0 -a-> 1 -a-> 2 ... -a-> 99, 99 is accepting
+        constexpr size_t n{ 100 };
+        std::vector<bool> accept(n, false);
+        accept[n - 1] = true;
+        std::vector<RE::NumberedTransition> trans;
+        for (RE::Index i = 0; i + 1 < n; ++i) {
+            trans.push_back(RE::NumberedTransition{ i, 0, i + 1 });
+        }
+        std::vector<RE::Index> blocks = RE::PartitionStates(accept, trans);
+        std::sort(blocks.begin(), blocks.end());
+        ASSERT_EQ(std::unique(blocks.begin(), blocks.end()) - blocks.begin(), n);
+    }
+
+    TEST(RegexpTest, RequiredLiteral) {
+        ASSERT_EQ(RE::Regexp{ U"[0-9]+ ERROR [A-Z]+" }.RequiredLiteral(), U" ERROR ");
+        ASSERT_EQ(RE::Regexp{ U"(foo|bar)baz" }.RequiredLiteral(), U"baz");
+        ASSERT_EQ(RE::Regexp{ U"a+b|a" }.RequiredLiteral(), U"");
+        ASSERT_EQ(RE::Regexp{ U"[a-z]+" }.RequiredLiteral(), U"");
+        ASSERT_EQ(RE::Regexp{ U"a\\.b\\u0041" }.RequiredLiteral(), U"a.bA");
     }
 
     TEST(RegexpTest, ValidRegexes) {
@@ -134,6 +229,520 @@ namespace RegexTest
         RegexSearchTest("RegexSearch_002.txt");
     }
 
+    TEST(RegexpTest, RegexMatchLazyDFA) {
+        RegexMatchTest("RegexMatch_001.txt", RE::REGFL_LAZYDFA);
+        RegexMatchTest("RegexMatch_002.txt", RE::REGFL_LAZYDFA);
+        RegexMatchTest("RegexMatch_003.txt", RE::REGFL_LAZYDFA);
+        RegexMatchTest("RegexMatch_004.txt", RE::REGFL_LAZYDFA);
+        RegexMatchTest("RegexMatch_005.txt", RE::REGFL_LAZYDFA);
+        RegexMatchTest("RegexMatch_006.txt", RE::REGFL_LAZYDFA);
+    }
+
+    TEST(RegexpTest, RegexSearchLazyDFA) {
+        RegexSearchTest("RegexSearch_001.txt", RE::REGFL_LAZYDFA);
+        RegexSearchTest("RegexSearch_002.txt", RE::REGFL_LAZYDFA);
+    }
+
+    TEST(RegexpTest, LazyDFACacheSize) {
+        // the DFA has 2^21 states, the cache of 16 states is cleared many times,
+        // the 'a' characters are at the multiples of 3
+        RE::Regexp re{ U"(a|b)*a(a|b){20}", RE::REGFL_LAZYDFA, 16 };
+        RE::UString text;
+        for (size_t i = 0; i < 1000; ++i) {
+            text += (i * 7 % 3 == 0) ? U'a' : U'b';
+        }
+        const std::vector<RE::MatchResults> results{ re.Search(text) };
+        ASSERT_EQ(results.size(), 1);
+        ASSERT_EQ(results[0].str.first - text.cbegin(), 0);
+        ASSERT_EQ(results[0].str.second - text.cbegin(), 999);
+        ASSERT_TRUE(re.Match(text.substr(0, 999)));
+        ASSERT_FALSE(re.Match(text));
+    }
+
+    TEST(RegexpTest, ReverseDFASize) {
+        // the reverse DFA would have 2^20 states, the search falls back to the lazy DFA
+        const RE::Regexp re{ U"[ab]{20}a[ab]*", RE::REGFL_UTF8 };
+        const RE::UString text{ U"ccc" + RE::UString(20, U'b') + U"abbc" + RE::UString(40, U'b') + U"c" + RE::UString(21, U'a') };
+        const std::vector<RE::MatchResults> results{ re.Search(text) };
+        ASSERT_EQ(results.size(), 2);
+        ASSERT_EQ(results[0].str.first - text.cbegin(), 3);
+        ASSERT_EQ(results[0].str.second - text.cbegin(), 26);
+        ASSERT_EQ(results[1].str.first - text.cbegin(), 68);
+        ASSERT_EQ(results[1].str.second - text.cbegin(), 89);
+        ASSERT_LT(re.MemoryUsage(), size_t{ 1 } << 20);
+
+        // the invalid byte splits the runs of the decoded text
+        std::string bytes{ RE::EncodeUtf8(text) };
+        bytes[67] = '\xFF';
+        const std::vector<RE::Utf8MatchResults> matches{ re.Search(bytes) };
+        ASSERT_EQ(matches.size(), 2);
+        ASSERT_EQ(matches[0].offset, 3);
+        ASSERT_EQ(matches[1].offset, 68);
+        ASSERT_EQ(matches[1].str.second - bytes.data(), 89);
+        ASSERT_LT(re.MemoryUsage(), size_t{ 1 } << 20);
+    }
+
+    TEST(RegexpTest, CountedRepetition) {
+        RE::UString digits(1000, U'7');
+        for (const RE::RegexpFlags flags : { RE::REGFL_NOFLAGS, RE::REGFL_LAZYDFA }) {
+            RE::Regexp re1{ U"x{1000}", flags };
+            ASSERT_TRUE(re1.Match(RE::UString(1000, U'x')));
+            ASSERT_FALSE(re1.Match(RE::UString(999, U'x')));
+            ASSERT_FALSE(re1.Match(RE::UString(1001, U'x')));
+
+            RE::Regexp re2{ U"id=[0-9]{1,1000};", flags };
+            ASSERT_TRUE(re2.Match(U"id=" + digits + U";"));
+            ASSERT_TRUE(re2.Match(U"id=0;"));
+            ASSERT_FALSE(re2.Match(U"id=" + digits + U"7;"));
+            ASSERT_FALSE(re2.Match(U"id=;"));
+            const RE::UString text{ U"id=" + digits + U"7; id=42; id=;" };
+            const std::vector<RE::MatchResults> results{ re2.Search(text) };
+            ASSERT_EQ(results.size(), 1);
+            ASSERT_EQ(results[0].str.first - text.cbegin(), 1006);
+            ASSERT_EQ(results[0].str.second - text.cbegin(), 1012);
+
+            RE::Regexp re3{ U"([a-f0-9]{2}:){5}[a-f0-9]{2,}", flags };
+            ASSERT_TRUE(re3.Match(U"00:1a:2b:3c:4d:5e"));
+            ASSERT_TRUE(re3.Match(U"00:1a:2b:3c:4d:5e6f"));
+            ASSERT_FALSE(re3.Match(U"00:1a:2b:3c:4d:5"));
+            ASSERT_FALSE(re3.Match(U"00:1a:2b:3c:4d5e"));
+        }
+    }
+
+    TEST(RegexpTest, CompileLimits) {
+        const size_t cacheSize = RE::Constants::lazyCacheSize;
+        RE::CompileOptions nfaLimit;
+        nfaLimit.maxNFANodes = 1000;
+        ASSERT_THROW((RE::Regexp{ U"x(abc){1000}", RE::REGFL_NOFLAGS, cacheSize, nfaLimit }), Error::CompileLimitExceeded);
+        ASSERT_NO_THROW((RE::Regexp{ U"x[0-9]{1,100000}", RE::REGFL_LAZYDFA, cacheSize, nfaLimit }));
+
+        RE::CompileOptions dfaLimit;
+        dfaLimit.maxDFAStates = 1000;
+        ASSERT_THROW((RE::Regexp{ U"(a|b)*a(a|b){12}", RE::REGFL_NOFLAGS, cacheSize, dfaLimit }), Error::CompileLimitExceeded);
+        ASSERT_NO_THROW((RE::Regexp{ U"(a|b)*a(a|b){12}", RE::REGFL_LAZYDFA, cacheSize, dfaLimit }));
+
+        RE::CompileOptions alphabetLimit;
+        alphabetLimit.maxAlphabetSize = 2;
+        ASSERT_THROW((RE::Regexp{ U"[a-c]x[e-g]", RE::REGFL_NOFLAGS, cacheSize, alphabetLimit }), Error::CompileLimitExceeded);
+
+        RE::CompileOptions timeLimit;
+        timeLimit.maxTime = 1;
+        ASSERT_THROW((RE::Regexp{ U"(a|b)*a(a|b){18}", RE::REGFL_NOFLAGS, cacheSize, timeLimit }), Error::CompileLimitExceeded);
+
+        // the options are kept by PutRE
+        RE::Regexp re{ U"ab+c", RE::REGFL_NOFLAGS, cacheSize, dfaLimit };
+        ASSERT_THROW(re.PutRE(U"(a|b)*a(a|b){12}"), Error::CompileLimitExceeded);
+        re.PutRE(U"(a|b)*a(a|b){12}", RE::CompileOptions{});
+        ASSERT_TRUE(re.Match(U"abbbbbbbbbbbb"));
+    }
+
+    TEST(RegexpTest, ConcurrentMatching) {
+        const RE::Regexp eager{ U"[0-9]+ (ERROR|WARN) [a-z]+(a|b){4}" };
+        const RE::Regexp lazy{ U"[0-9]+ (ERROR|WARN) [a-z]+(a|b){4}", RE::REGFL_LAZYDFA, 16 };
+        RE::UString text;
+        for (size_t i = 0; i < 2000; ++i) {
+            const std::string number{ std::to_string(i) };
+            text += RE::UString{ number.begin(), number.end() } + ((i % 3 == 0) ? U" ERROR " : U" WARN ") + ((i % 5 == 0) ? U"xabab\n" : U"xabcb\n");
+        }
+        const std::vector<RE::MatchResults> expected{ eager.Search(text) };
+        ASSERT_EQ(expected.size(), 400);
+
+        // the threads share both Regexps, each thread has its own cache for the lazy one
+        constexpr size_t nThreads = 8;
+        std::vector<size_t> errors(nThreads, 0);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < nThreads; ++t) {
+            threads.emplace_back([&, t]() {
+                RE::LazyCache cache;
+                for (size_t k = 0; k < 10; ++k) {
+                    for (const std::vector<RE::MatchResults>& results : { eager.Search(text), lazy.Search(text, cache) }) {
+                        if (results.size() != expected.size()) {
+                            ++errors[t];
+                            continue;
+                        }
+                        for (size_t i = 0; i < results.size(); ++i) {
+                            if (results[i].str != expected[i].str || results[i].ln != expected[i].ln) {
+                                ++errors[t];
+                            }
+                        }
+                    }
+                    const RE::UString line{ expected[k].str.first, expected[k].str.second };
+                    if (!eager.Match(line) || !lazy.Match(line, cache) || lazy.Match(line + U"0", cache)) {
+                        ++errors[t];
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        for (const size_t e : errors) {
+            ASSERT_EQ(e, 0);
+        }
+    }
+
+    TEST(RegexpTest, RegexCache) {
+        RE::RegexCache cache;
+        const RE::RegexCache::Handle a1 = cache.Get(U"a[0-9]+b");
+        const RE::RegexCache::Handle a2 = cache.Get(U"a[0-9]+b");
+        ASSERT_EQ(a1, a2);
+        ASSERT_TRUE(a1->Match(U"a123b"));
+        ASSERT_NE(cache.Get(U"a[0-9]+b", RE::REGFL_LAZYDFA), a1);
+        ASSERT_THROW(cache.Get(U"a[0-9+b"), Error::InvalidRegex);
+        RE::RegexCache::Statistics stats = cache.GetStatistics();
+        ASSERT_EQ(stats.hits, 1);
+        ASSERT_EQ(stats.misses, 3);
+        ASSERT_EQ(stats.evictions, 0);
+        ASSERT_EQ(stats.size, 2);
+        ASSERT_EQ(stats.memory, a1->MemoryUsage() + cache.Get(U"a[0-9]+b", RE::REGFL_LAZYDFA)->MemoryUsage());
+
+        // the budget holds two of the three Regexps, the least recently used one is evicted
+        const RE::Regexp b{ U"b[0-9]+c" };
+        const RE::Regexp c{ U"c[0-9]+d" };
+        RE::RegexCache small{ a1->MemoryUsage() + b.MemoryUsage() + c.MemoryUsage() - 1 };
+        const RE::RegexCache::Handle sa = small.Get(U"a[0-9]+b");
+        const RE::RegexCache::Handle sb = small.Get(U"b[0-9]+c");
+        ASSERT_EQ(small.Get(U"a[0-9]+b"), sa);
+        small.Get(U"c[0-9]+d");
+        stats = small.GetStatistics();
+        ASSERT_EQ(stats.evictions, 1);
+        ASSERT_EQ(stats.size, 2);
+        ASSERT_LE(stats.memory, small.Budget());
+        ASSERT_EQ(small.Get(U"a[0-9]+b"), sa);
+        ASSERT_NE(small.Get(U"b[0-9]+c"), sb);
+        ASSERT_TRUE(sb->Match(U"b0c"));                 // the handle keeps the evicted Regexp
+
+        // a Regexp larger than the budget is not cached
+        RE::RegexCache tiny{ 1 };
+        ASSERT_TRUE(tiny.Get(U"a[0-9]+b")->Match(U"a0b"));
+        ASSERT_EQ(tiny.GetStatistics().size, 0);
+
+        // concurrent lookups of the same patterns
+        RE::RegexCache shared;
+        std::vector<size_t> errors(8, 0);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < errors.size(); ++t) {
+            threads.emplace_back([&, t]() {
+                for (size_t k = 0; k < 1000; ++k) {
+                    const std::string number{ std::to_string(k % 10) };
+                    const RE::UString digit{ number.begin(), number.end() };
+                    if (!shared.Get(U"x" + digit + U"[a-z]+")->Match(U"x" + digit + U"abc")) {
+                        ++errors[t];
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        for (const size_t e : errors) {
+            ASSERT_EQ(e, 0);
+        }
+        stats = shared.GetStatistics();
+        ASSERT_EQ(stats.size, 10);
+        ASSERT_EQ(stats.hits + stats.misses, 8000);
+        ASSERT_GE(stats.misses, 10);
+    }
+
+    TEST(RegexpTest, SearchParallel) {
+        RE::UString text;
+        const RE::UString newLines[]{ U"\n", U"\r\n", U"\u2028", U" " };
+        for (size_t i = 0; text.size() < 20 * RE::Constants::minChunkSize; ++i) {
+            const std::string number{ std::to_string(i * 7919 % 100000) };
+            text += RE::UString{ number.begin(), number.end() } + ((i % 3 == 0) ? U" ERROR " : U" WARN ")
+                + ((i % 5 == 0) ? U"xabab" : U"xabcb") + newLines[i % 4];
+        }
+        const std::vector<SearchPattern> patterns{
+            { U"[0-9]+ (ERROR|WARN) [a-z]+(a|b){4}", RE::REGFL_NOFLAGS },
+            { U"[0-9]+ (ERROR|WARN) [a-z]+(a|b){4}", RE::REGFL_LAZYDFA },
+            { U"[0-9]*5 ERROR", RE::REGFL_NOFLAGS },
+            { U"ab", RE::REGFL_NOFLAGS },
+            { U"ERROR|WARN|ab", RE::REGFL_NOFLAGS },
+            { U"[^#]+", RE::REGFL_NOFLAGS },                 // every character may be a part of a match
+        };
+        SearchPatternsTest(text, patterns, 1, [&](const RE::Regexp& re, const std::vector<RE::MatchResults>& expected) {
+            for (const size_t nThreads : { 1, 3, 8 }) {
+                SameMatchesTest(re.SearchParallel(text, nThreads), expected);
+            }
+        });
+    }
+
+    TEST(RegexpTest, StreamMatcher) {
+        const RE::UString text{ U"12 ERROR xabab\r\n7 WARN xabcb\n345 WARN aab\u2028ab abab a+b 99 ERROR yaaaa" };
+        const std::vector<SearchPattern> patterns{
+            { U"[0-9]+ (ERROR|WARN) [a-z]+(a|b){4}", RE::REGFL_NOFLAGS },
+            { U"[0-9]+ (ERROR|WARN) [a-z]+(a|b){4}", RE::REGFL_LAZYDFA },
+            { U"(a|b)*a(a|b)", RE::REGFL_NOFLAGS },
+            { U"ab", RE::REGFL_NOFLAGS },
+            { U"ab|aab|abab|WARN", RE::REGFL_NOFLAGS },
+        };
+        SearchPatternsTest(text, patterns, 1, [&](const RE::Regexp& re, const std::vector<RE::MatchResults>& expected) {
+            RE::StreamMatcher matcher{ re };
+            for (const size_t chunkSize : { 1, 2, 5, 100 }) {
+                std::vector<RE::StreamMatch> matches;
+                for (size_t i = 0; i < text.size(); i += chunkSize) {
+                    const std::vector<RE::StreamMatch> found{ matcher.Feed(text.substr(i, chunkSize)) };
+                    matches.insert(matches.end(), found.begin(), found.end());
+                }
+                const std::vector<RE::StreamMatch> found{ matcher.Finish() };
+                matches.insert(matches.end(), found.begin(), found.end());
+                SameMatchesTest(matches, expected, [&](const RE::StreamMatch& match, const RE::MatchResults& mr) {
+                    ASSERT_EQ(match.offset, mr.str.first - text.cbegin());
+                });
+            }
+        });
+
+        // only the characters that an open match may need are kept
+        const RE::Regexp re{ U"ERROR [0-9]+" };
+        RE::StreamMatcher matcher{ re };
+        size_t nMatches = 0;
+        for (size_t i = 0; i < 10000; ++i) {
+            nMatches += matcher.Feed(U"line without matches\nERROR 42").size();
+            ASSERT_LE(matcher.Retained(), 8);
+        }
+        nMatches += matcher.Finish().size();
+        ASSERT_EQ(nMatches, 10000);
+
+        // the run from the first 'a' may still reach 'z', the text after each pending match is not read again
+        const RE::Regexp growing{ U"a|a[^z]*z" };
+        RE::UString pairs;
+        for (size_t i = 0; i < 4000; ++i) {
+            pairs += U"a ";
+        }
+        RE::StreamMatcher growingMatcher{ growing };
+        std::vector<RE::StreamMatch> matches;
+        for (size_t i = 0; i < pairs.size(); i += 100) {
+            const std::vector<RE::StreamMatch> found{ growingMatcher.Feed(pairs.substr(i, 100)) };
+            matches.insert(matches.end(), found.begin(), found.end());
+        }
+        ASSERT_LE(growingMatcher.Steps(), pairs.size());
+        const std::vector<RE::StreamMatch> found{ growingMatcher.Finish() };
+        matches.insert(matches.end(), found.begin(), found.end());
+        ASSERT_EQ(matches.size(), 4000);
+        ASSERT_EQ(matches.back().offset, 7998);
+        ASSERT_EQ(matches.back().pos, 7999);
+
+        // more runs than the states of a small cache are moved on one character
+        const RE::Regexp small{ U"[a-c]{10}([a-c]|[ab]a)a([^\\n][^\\n])*b{3,}", RE::REGFL_LAZYDFA, 16 };
+        RE::UString lines;
+        for (size_t i = 0, x = 1; i < 40 * 400; ++i) {
+            x = (x * 1103515245 + 12345) % 2147483648;
+            lines += (i % 400 == 399) ? U'\n' : ((x >> 16) % 2 == 0) ? U'a' : U'b';
+        }
+        const std::vector<RE::MatchResults> expected{ small.Search(lines) };
+        ASSERT_GT(expected.size(), 0);
+        RE::StreamMatcher smallMatcher{ small };
+        std::vector<RE::StreamMatch> smallMatches;
+        for (size_t i = 0; i < lines.size(); i += 7) {
+            const std::vector<RE::StreamMatch> chunkMatches{ smallMatcher.Feed(lines.substr(i, 7)) };
+            smallMatches.insert(smallMatches.end(), chunkMatches.begin(), chunkMatches.end());
+        }
+        const std::vector<RE::StreamMatch> lastMatches{ smallMatcher.Finish() };
+        smallMatches.insert(smallMatches.end(), lastMatches.begin(), lastMatches.end());
+        SameMatchesTest(smallMatches, expected, [&](const RE::StreamMatch& match, const RE::MatchResults& mr) {
+            ASSERT_EQ(match.offset, mr.str.first - lines.cbegin());
+        });
+    }
+
+    TEST(RegexpTest, Utf8) {
+        const RE::UString text{ U"12 ERROR \u00e9\u03c0\u20ac\r\n7 WARN x\U0001F600b\n345 WARN aab\u2028\u00e9b abab a+b 99 ERROR y\u20ac\u20ac" };
+        const std::string bytes{ RE::EncodeUtf8(text) };
+        ASSERT_TRUE(RE::DecodeUtf8(bytes) == text);
+        const std::vector<SearchPattern> patterns{
+            { U"[0-9]+ (ERROR|WARN) [^ \\n]+", RE::REGFL_UTF8 },
+            { U"[0-9]+ (ERROR|WARN) [^ \\n]+", RE::REGFL_LAZYDFA | RE::REGFL_UTF8 },
+            { U"\u00e9|\u20ac+|x\U0001F600", RE::REGFL_UTF8 },
+            { U"[\u0080-\U0010FFFF]+b", RE::REGFL_UTF8 },
+            { U"ab", RE::REGFL_UTF8 },
+        };
+        SearchPatternsTest(text, patterns, 1, [&](const RE::Regexp& re, const std::vector<RE::MatchResults>& expected) {
+            SameMatchesTest(re.Search(bytes), expected, [&](const RE::Utf8MatchResults& match, const RE::MatchResults& mr) {
+                const std::string str{ match.str.first, match.str.second };
+                ASSERT_EQ(match.offset, RE::EncodeUtf8(RE::UString(text.cbegin(), mr.str.first)).size());
+                ASSERT_EQ(match.str.first, bytes.data() + match.offset);
+                ASSERT_TRUE(str == RE::EncodeUtf8(RE::UString(mr.str.first, mr.str.second)));
+                ASSERT_TRUE(re.Match(str));
+            });
+            ASSERT_FALSE(re.Match(bytes));
+        });
+
+        // the bytes of invalid sequences are not a part of a match
+        const RE::Regexp re{ U"[^ ]+", RE::REGFL_UTF8 };
+        const std::string invalid{ "ab\xC0\xAF" "cd\xED\xA0\x80" "e\xE2\x82" };
+        const std::vector<RE::Utf8MatchResults> matches{ re.Search(invalid) };
+        ASSERT_EQ(matches.size(), 3);
+        ASSERT_EQ(matches[0].offset, 0);
+        ASSERT_EQ(matches[1].offset, 4);
+        ASSERT_EQ(matches[2].offset, 9);
+        ASSERT_EQ(matches[2].str.second - matches[2].str.first, 1);
+        ASSERT_FALSE(re.Match(invalid));
+        ASSERT_TRUE(RE::DecodeUtf8("\xC0\xAF" "e") == U"\uFFFD\uFFFDe");
+        ASSERT_THROW(RE::Regexp{ U"ab" }.Search(bytes), Error::RuntimeError);
+    }
+
+    TEST(RegexpTest, RegexSet) {
+        const std::vector<RE::UString> patterns{
+            U"[0-9]+ ERROR", U"WARN", U"(ab|cd)+x", U"a[0-9]{2,3}b", U"zzz", U"[a-z]+@[a-z]+", U"ab",
+        };
+        const RE::RegexSet set{ patterns };
+        ASSERT_EQ(set.Size(), patterns.size());
+        const RE::UString texts[]{
+            U"12 WARN abcdx 99 ERROR", U"a123b ab", U"mail: x@y, zzz", U"nothing", U"a1b abab", U"",
+        };
+        for (const RE::UString& text : texts) {
+            std::vector<RE::Index> expected;
+            for (RE::Index k = 0; k < patterns.size(); ++k) {
+                if (!RE::Regexp{ patterns[k] }.Search(text).empty()) {
+                    expected.push_back(k);
+                }
+            }
+            ASSERT_EQ(set.Matches(text), expected);
+        }
+
+        // a match is reported at its first end
+        const std::vector<RE::SetMatch> matches{ set.Search(U"12 WARN abcdx 99 ERROR") };
+        ASSERT_EQ(matches.size(), 4);
+        ASSERT_EQ(matches[0].pattern, 1);
+        ASSERT_EQ(matches[0].end, 7);
+        ASSERT_EQ(matches[1].pattern, 6);
+        ASSERT_EQ(matches[1].end, 10);
+        ASSERT_EQ(matches[2].pattern, 2);
+        ASSERT_EQ(matches[2].end, 13);
+        ASSERT_EQ(matches[3].pattern, 0);
+        ASSERT_EQ(matches[3].end, 22);
+        ASSERT_THROW(RE::RegexSet({ U"ab", U"a*" }), Error::InvalidRegex);
+        ASSERT_THROW(RE::RegexSet({ U"ab", U"a(b" }), Error::InvalidRegex);
+        ASSERT_THROW(RE::RegexSet(std::vector<RE::UString>{}), Error::InvalidRegex);
+    }
+
+    TEST(RegexpTest, Scanner) {
+        enum : RE::Index { IF, ID, NUMBER, REAL, OP, SPACE };
+        const RE::Scanner scanner{ {
+            { U"if", IF },
+            { U"[a-z][a-z0-9]*", ID },
+            { U"[0-9]+", NUMBER },
+            { U"[0-9]+\\.[0-9]+(e[0-9]+)?", REAL },
+            { U"[-+*/=<>]|<=|>=|==", OP },
+            { U"[ \\n]+", SPACE },
+        } };
+        const RE::UString text{ U"if x1>=12.5e3 iff 7.a\n" };
+        const std::vector<RE::Token> tokens{ scanner.Tokenize(text) };
+        const std::vector<std::pair<RE::Index, RE::UString>> expected{
+            { IF, U"if" }, { SPACE, U" " }, { ID, U"x1" }, { OP, U">=" }, { REAL, U"12.5e3" }, { SPACE, U" " },
+            { ID, U"iff" }, { SPACE, U" " }, { NUMBER, U"7" }, { RE::Scanner::error, U"." }, { ID, U"a" },
+            { SPACE, U"\n" },
+        };
+        ASSERT_EQ(tokens.size(), expected.size());
+        size_t offset = 0;
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            ASSERT_EQ(tokens[i].id, expected[i].first);
+            ASSERT_EQ(tokens[i].offset, offset);
+            ASSERT_TRUE(text.substr(tokens[i].offset, tokens[i].length) == expected[i].second);
+            offset += tokens[i].length;
+        }
+
+        // the rollback after the longest match is linear
+        const RE::Scanner ab{ { { U"a", 0 }, { U"(ab)*abc", 1 } } };
+        RE::UString abab;
+        for (size_t i = 0; i < 20000; ++i) {
+            abab += U"ab";
+        }
+        const std::vector<RE::Token> abTokens{ ab.Tokenize(abab) };
+        ASSERT_EQ(abTokens.size(), 40000);
+        ASSERT_EQ(abTokens[0].id, 0);
+        ASSERT_EQ(abTokens[1].id, RE::Scanner::error);
+        ASSERT_THROW(RE::Scanner({ { U"a", 0 }, { U"b?", 1 } }), Error::InvalidRegex);
+    }
+
+    TEST(RegexpTest, MatchIterator) {
+        const RE::UString text{ U"12 ERROR x\n7 WARN yy\r\n345 WARN aab abab a+b 99 ERROR zz" };
+        const std::vector<SearchPattern> patterns{
+            { U"ERROR", RE::REGFL_NOFLAGS },
+            { U"ERROR|WARN", RE::REGFL_NOFLAGS },
+            { U"[0-9]+ (ERROR|WARN) [a-z]+", RE::REGFL_NOFLAGS },
+            { U"[0-9]+ (ERROR|WARN) [a-z]+", RE::REGFL_LAZYDFA },
+            { U"(ab)+|a\\+b", RE::REGFL_NOFLAGS },
+            { U"[a-z]+", RE::REGFL_LAZYDFA },
+        };
+        SearchPatternsTest(text, patterns, 2, [&](const RE::Regexp& re, const std::vector<RE::MatchResults>& expected) {
+            std::vector<RE::MatchResults> matches;
+            for (const RE::MatchResults& mr : re.Matches(text)) {
+                matches.push_back(mr);
+            }
+            std::vector<RE::MatchResults> visited;
+            ASSERT_TRUE(re.Search(text, [&](const RE::MatchResults& mr) {
+                visited.push_back(mr);
+                return true;
+            }));
+            SameMatchesTest(matches, expected);
+            SameMatchesTest(visited, expected);
+
+            // the search stops when the callback returns false
+            size_t count = 0;
+            ASSERT_FALSE(re.Search(text, [&count](const RE::MatchResults&) { return ++count < 2; }));
+            ASSERT_EQ(count, 2);
+        });
+        const RE::Regexp re{ U"x+" };
+        const RE::UString empty;
+        ASSERT_TRUE(re.Matches(empty).begin() == re.Matches(empty).end());
+        RE::MatchIterator it{ re, text };
+        ASSERT_EQ(it->ln, 1);
+        ASSERT_EQ(it->pos, 10);
+        ASSERT_TRUE(++it == RE::MatchIterator{});
+    }
+
+    TEST(RegexpTest, Queries) {
+        const RE::UString text{ U"12 ERROR x\n7 WARN yy abcd\r\n345 WARN aab abab a+b 99 ERROR zz" };
+        const std::vector<SearchPattern> patterns{
+            { U"ERROR", RE::REGFL_NOFLAGS },
+            { U"abcd|bc", RE::REGFL_NOFLAGS },
+            { U"[0-9]+ (ERROR|WARN) [a-z]+", RE::REGFL_NOFLAGS },
+            { U"[0-9]+ (ERROR|WARN) [a-z]+", RE::REGFL_LAZYDFA },
+            { U"[a-z]*b[0-9]*", RE::REGFL_NOFLAGS },
+            { U"[a-z]*b[0-9]*", RE::REGFL_LAZYDFA },
+            { U"Q[0-9]", RE::REGFL_NOFLAGS },
+            { U"Q[0-9]", RE::REGFL_LAZYDFA },
+        };
+        SearchPatternsTest(text, patterns, 0, [&](const RE::Regexp& re, const std::vector<RE::MatchResults>& expected) {
+            ASSERT_EQ(re.Contains(text), !expected.empty());
+            ASSERT_EQ(re.Count(text), expected.size());
+            const RE::MatchResults::Matched first{ re.FindFirst(text) };
+            if (expected.empty()) {
+                ASSERT_TRUE(first.first == text.cend() && first.second == text.cend());
+                ASSERT_EQ(re.EarliestMatchEnd(text), RE::UString::npos);
+                return;
+            }
+            ASSERT_TRUE(first == expected[0].str);
+
+            // no match ends before the earliest end
+            const size_t end = re.EarliestMatchEnd(text);
+            ASSERT_LE(end, static_cast<size_t>(expected[0].str.second - text.cbegin()));
+            for (size_t e = 1; e < end; ++e) {
+                for (size_t b = 0; b < e; ++b) {
+                    ASSERT_FALSE(re.Match(text.substr(b, e - b)));
+                }
+            }
+            ASSERT_TRUE(re.Contains(text.substr(0, end)));
+            ASSERT_FALSE(re.Contains(text.substr(0, end - 1)));
+        });
+        ASSERT_EQ(RE::Regexp{ U"abcd|bc" }.EarliestMatchEnd(U"abcd"), 3);
+        ASSERT_EQ(RE::Regexp{ U"a+b|b" }.EarliestMatchEnd(U"xaaab"), 5);
+        ASSERT_EQ(RE::Regexp{ U"[0-9]+" }.EarliestMatchEnd(U"ab123"), 3);
+
+        // the text without the characters that end a match is skipped, a match may cross the windows
+        // of the backward pass
+        RE::UString letters;
+        for (size_t i = 0; i < 1000000; ++i) {
+            letters += static_cast<char32_t>(U'a' + i * 7 % 26);
+        }
+        const RE::Regexp digits{ U"[a-z]+[0-9]+" };
+        ASSERT_FALSE(digits.Contains(letters));
+        ASSERT_EQ(digits.EarliestMatchEnd(letters + U"1"), letters.size() + 1);
+        const RE::Regexp counted{ U"a[ab]{10}c" };
+        ASSERT_FALSE(counted.Contains(letters));
+        ASSERT_EQ(counted.EarliestMatchEnd(RE::UString(4090, U'x') + U"aabababababc" + letters), 4102);
+    }
+
     ///----------------------------------------------------------------------------------------------------
 
     std::basic_string<char32_t> ToChar(unsigned int x)
@@ -632,10 +1241,10 @@ namespace RegexTest
         PRINT_COUNTER;
     }
 
-    void RegexMatchTest(const std::string& fileName)
+    void RegexMatchTest(const std::string& fileName, const RE::RegexpFlags flags)
     {
         INIT_COUNTER;
-        const std::string reportFileName{ "ErrorReport_" + fileName };
+        const std::string reportFileName{ (FLAG_IS_SET(flags, RE::REGFL_LAZYDFA) ? "ErrorReport_Lazy_" : "ErrorReport_") + fileName };
         std::remove(reportFileName.c_str());
         std::locale loc(std::locale(), new std::codecvt_utf8<char32_t>);
         std::basic_ifstream<char32_t> ifs{ fileName };
@@ -650,8 +1259,8 @@ namespace RegexTest
             std::basic_ostringstream<char32_t> oss;
             oss << U"RegexMatchCase #" << /*i + 1*/ ToChar(i + 1) << std::endl << std::endl;
             try {
-                RE::Regexp re1{ rmcase.re }; COUNT;
-                RE::Regexp re2{ RE::UString{'a'} };
+                RE::Regexp re1{ rmcase.re, flags }; COUNT;
+                RE::Regexp re2{ RE::UString{'a'}, flags };
                 re2.PutRE(rmcase.re); COUNT;
                 bool printReport{ false };
                 for (size_t j = 0; j < rmcase.valid.size(); ++j) {
@@ -702,10 +1311,10 @@ namespace RegexTest
         PRINT_COUNTER;
     }
 
-    void RegexSearchTest(const std::string& fileName)
+    void RegexSearchTest(const std::string& fileName, const RE::RegexpFlags flags)
     {
         INIT_COUNTER;
-        const std::string reportFileName{ "ErrorReport_" + fileName };
+        const std::string reportFileName{ (FLAG_IS_SET(flags, RE::REGFL_LAZYDFA) ? "ErrorReport_Lazy_" : "ErrorReport_") + fileName };
         std::remove(reportFileName.c_str());
         std::locale loc(std::locale(), new std::codecvt_utf8<char32_t>);
         std::basic_ifstream<char32_t> ifs{ fileName };
@@ -720,8 +1329,8 @@ namespace RegexTest
             std::basic_ostringstream<char32_t> oss;
             oss << U"RegexSearchCase #" << /*i + 1*/ ToChar(i + 1) << std::endl << std::endl;
             try {
-                RE::Regexp re1{ rscase.re }; COUNT;
-                RE::Regexp re2{ RE::UString{'a'} };
+                RE::Regexp re1{ rscase.re, flags }; COUNT;
+                RE::Regexp re2{ RE::UString{'a'}, flags };
                 re2.PutRE(rscase.re); COUNT;
                 bool printReport{ false };
                 const bool equal{ re1 == re2 };
@@ -781,4 +1390,54 @@ namespace RegexTest
         }
         PRINT_COUNTER;
     }
+
+    RE::UString MatchString(const RE::MatchResults& mr)
+    {
+        return RE::UString{ mr.str.first, mr.str.second };
+    }
+
+    RE::UString MatchString(const RE::StreamMatch& match)
+    {
+        return match.str;
+    }
+
+    RE::UString MatchString(const RE::Utf8MatchResults& match)
+    {
+        return RE::DecodeUtf8(std::string{ match.str.first, match.str.second });
+    }
+
+    // 'test(re, expected)' checks another search API against Search: it is called for the Regexp of each
+    // pattern, 'expected' holds the matches of Search in 'text', there must be at least 'minMatches' of them
+    template<class Test>
+    void SearchPatternsTest(const RE::UString& text, const std::vector<SearchPattern>& patterns,
+        const size_t minMatches, Test test)
+    {
+        for (const SearchPattern& pattern : patterns) {
+            const RE::Regexp re{ pattern.first, pattern.second };
+            const std::vector<RE::MatchResults> expected{ re.Search(text) };
+            ASSERT_GE(expected.size(), minMatches) << "Pattern: " << RE::GetGlyph(pattern.first);
+            test(re, expected);
+        }
+    }
+
+    // 'matches' must have the lines, the positions and the strings of 'expected',
+    // 'check(match, mr)' checks the fields of the API under test
+    template<class Match, class Check>
+    void SameMatchesTest(const std::vector<Match>& matches, const std::vector<RE::MatchResults>& expected,
+        Check check)
+    {
+        ASSERT_EQ(matches.size(), expected.size());
+        for (size_t i = 0; i < matches.size(); ++i) {
+            ASSERT_EQ(matches[i].ln, expected[i].ln);
+            ASSERT_EQ(matches[i].pos, expected[i].pos);
+            ASSERT_TRUE(MatchString(matches[i]) == MatchString(expected[i]));
+            check(matches[i], expected[i]);
+        }
+    }
+
+    template<class Match>
+    void SameMatchesTest(const std::vector<Match>& matches, const std::vector<RE::MatchResults>& expected)
+    {
+        SameMatchesTest(matches, expected, [](const Match&, const RE::MatchResults&) {});
+    }
 } // namespace RegexTest
@@ -36,6 +36,8 @@ namespace RegexTest
         std::vector<RegexSearchCase> vec;
     };
 
+    using SearchPattern = std::pair<RE::UString, RE::RegexpFlags>;
+
     struct InputBuffer {
         RE::UString str;
         bool full;
@@ -72,8 +74,23 @@ namespace RegexTest
 
     void RegexValidTest(const std::string& fileName);
     void RegexInvalidTest(const std::string& fileName);
-    void RegexMatchTest(const std::string& fileName);
-    void RegexSearchTest(const std::string& fileName);
+    void RegexMatchTest(const std::string& fileName, const RE::RegexpFlags flags = RE::REGFL_NOFLAGS);
+    void RegexSearchTest(const std::string& fileName, const RE::RegexpFlags flags = RE::REGFL_NOFLAGS);
+
+    RE::UString MatchString(const RE::MatchResults& mr);
+    RE::UString MatchString(const RE::StreamMatch& match);
+    RE::UString MatchString(const RE::Utf8MatchResults& match);
+
+    template<class Test>
+    void SearchPatternsTest(const RE::UString& text, const std::vector<SearchPattern>& patterns,
+        const size_t minMatches, Test test);
+
+    template<class Match, class Check>
+    void SameMatchesTest(const std::vector<Match>& matches, const std::vector<RE::MatchResults>& expected,
+        Check check);
+
+    template<class Match>
+    void SameMatchesTest(const std::vector<Match>& matches, const std::vector<RE::MatchResults>& expected);
 }
 
 #endif // REGEXPR_TEST_HPP